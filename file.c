@@ -95,15 +95,24 @@ void loadImage(const char *filename, Image *image, Pixel sheet_background,
       (RectangleSize){.width = frame->width, .height = frame->height});
 
   switch (frame->format) {
-  case AV_PIX_FMT_Y400A: // 8-bit grayscale PNG
+  case AV_PIX_FMT_Y400A: { // 8-bit grayscale PNG
+    // The alpha channel is never used, so drop it right away rather than
+    // carrying it through the whole processing.
+    Image loaded = {frame, sheet_background, abs_black_threshold};
+    *image = create_image(size_of_rectangle(area), AV_PIX_FMT_GRAY8, false,
+                          sheet_background, abs_black_threshold);
+    copy_rectangle(loaded, *image, area, POINT_ORIGIN);
+  } break;
+
   case AV_PIX_FMT_GRAY8:
   case AV_PIX_FMT_RGB24:
   case AV_PIX_FMT_MONOBLACK:
   case AV_PIX_FMT_MONOWHITE:
-    *image = create_image(size_of_rectangle(area), frame->format, false,
-                          sheet_background, abs_black_threshold);
-    av_frame_free(&image->frame);
-    image->frame = av_frame_clone(frame);
+    *image = (Image){
+        .frame = av_frame_clone(frame),
+        .background = sheet_background,
+        .abs_black_threshold = abs_black_threshold,
+    };
     break;
 
   case AV_PIX_FMT_PAL8: {
@@ -122,6 +131,8 @@ void loadImage(const char *filename, Image *image, Pixel sheet_background,
     errOutput("unable to open file %s: unsupported pixel format", filename);
   }
 
+  av_frame_free(&frame);
+  av_packet_unref(&pkt);
   avcodec_free_context(&avctx);
   avformat_close_input(&s);
 }
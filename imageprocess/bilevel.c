@@ -0,0 +1,217 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/bilevel.h"
+#include "imageprocess/pixel.h"
+#include "imageprocess/pixel_formats.h"
+
+/**
+ * Returns whether the image packs its pixels as single bits, in which case
+ * the operations in this file can work on whole bytes and words at a time.
+ */
+bool is_bilevel_image(Image image) {
+  return image.frame->format == AV_PIX_FMT_MONOWHITE ||
+         image.frame->format == AV_PIX_FMT_MONOBLACK;
+}
+
+/**
+ * Returns the bit value that stores the given pixel in a bilevel image.
+ */
+bool bilevel_bit(Image image, Pixel pixel) {
+  if (image.frame->format == AV_PIX_FMT_MONOWHITE) {
+    return monowhite_bit(pixel, image.abs_black_threshold);
+  }
+  return monoblack_bit(pixel, image.abs_black_threshold);
+}
+
+/**
+ * Returns the brightness of the pixels stored with the given bit value in a
+ * bilevel image.
+ */
+uint8_t bilevel_bit_grayscale(Image image, bool bit) {
+  if (image.frame->format == AV_PIX_FMT_MONOWHITE) {
+    return monowhite_bit_grayscale(bit);
+  }
+  return monoblack_bit_grayscale(bit);
+}
+
+/**
+ * Returns whether the pixel at the given coordinates of a bilevel image is
+ * black. The coordinates are not checked.
+ */
+bool bilevel_is_black(Image image, Point coords) {
+  return bilevel_bit_grayscale(
+             image, mono_bit(get_pixel_row(image, coords.y), coords.x)) == 0;
+}
+
+// Mask of the bits of a byte from bit first to bit last (inclusive), with bit
+// 0 being the most significant one.
+static inline uint8_t bits_mask(int32_t first, int32_t last) {
+  return (0xFF >> first) & (uint8_t)(0xFF << (7 - last));
+}
+
+uint64_t count_bits(const uint8_t *row, int32_t x, int32_t count) {
+  if (count <= 0) {
+    return 0;
+  }
+
+  const int32_t first_byte = x / 8, last_byte = (x + count - 1) / 8;
+  const int32_t last_bit = (x + count - 1) % 8;
+
+  if (first_byte == last_byte) {
+    return av_popcount(row[first_byte] & bits_mask(x % 8, last_bit));
+  }
+
+  uint64_t result = av_popcount(row[first_byte] & bits_mask(x % 8, 7));
+
+  int32_t i = first_byte + 1;
+  for (; i + 8 <= last_byte; i += 8) {
+    uint64_t word;
+    memcpy(&word, row + i, sizeof(word));
+    result += av_popcount64(word);
+  }
+  for (; i < last_byte; i++) {
+    result += av_popcount(row[i]);
+  }
+
+  return result + av_popcount(row[last_byte] & bits_mask(0, last_bit));
+}
+
+void fill_bits(uint8_t *row, int32_t x, int32_t count, bool value) {
+  if (count <= 0) {
+    return;
+  }
+
+  const int32_t first_byte = x / 8, last_byte = (x + count - 1) / 8;
+  const int32_t last_bit = (x + count - 1) % 8;
+
+  if (first_byte == last_byte) {
+    const uint8_t mask = bits_mask(x % 8, last_bit);
+    if (value) {
+      row[first_byte] |= mask;
+    } else {
+      row[first_byte] &= ~mask;
+    }
+    return;
+  }
+
+  const uint8_t first_mask = bits_mask(x % 8, 7);
+  const uint8_t last_mask = bits_mask(0, last_bit);
+  if (value) {
+    row[first_byte] |= first_mask;
+    row[last_byte] |= last_mask;
+  } else {
+    row[first_byte] &= ~first_mask;
+    row[last_byte] &= ~last_mask;
+  }
+  memset(row + first_byte + 1, value ? 0xFF : 0x00,
+         last_byte - first_byte - 1);
+}
+
+void invert_bits(uint8_t *row, int32_t x, int32_t count) {
+  if (count <= 0) {
+    return;
+  }
+
+  const int32_t first_byte = x / 8, last_byte = (x + count - 1) / 8;
+  const int32_t last_bit = (x + count - 1) % 8;
+
+  if (first_byte == last_byte) {
+    row[first_byte] ^= bits_mask(x % 8, last_bit);
+    return;
+  }
+
+  row[first_byte] ^= bits_mask(x % 8, 7);
+  for (int32_t i = first_byte + 1; i < last_byte; i++) {
+    row[i] = ~row[i];
+  }
+  row[last_byte] ^= bits_mask(0, last_bit);
+}
+
+/**
+ * Copies count bits from one packed row to another, which must not overlap.
+ * Bits of the target outside of the copied run are preserved.
+ */
+void copy_bits(const uint8_t *source, int32_t source_x, uint8_t *target,
+               int32_t target_x, int32_t count) {
+  // Copy single bits until the target is aligned to a byte boundary.
+  for (; count > 0 && target_x % 8 != 0; count--) {
+    set_mono_bit(target, target_x++, mono_bit(source, source_x++));
+  }
+
+  const int32_t bytes = count / 8;
+  const int32_t shift = source_x % 8;
+  const uint8_t *src = source + source_x / 8;
+  uint8_t *dst = target + target_x / 8;
+
+  if (shift == 0) {
+    memcpy(dst, src, bytes);
+  } else {
+    for (int32_t i = 0; i < bytes; i++) {
+      dst[i] = (src[i] << shift) | (src[i + 1] >> (8 - shift));
+    }
+  }
+
+  source_x += bytes * 8;
+  target_x += bytes * 8;
+  for (count -= bytes * 8; count > 0; count--) {
+    set_mono_bit(target, target_x++, mono_bit(source, source_x++));
+  }
+}
+
+static inline uint8_t reverse_byte(uint8_t b) {
+  b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+  b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+  return (b & 0xAA) >> 1 | (b & 0x55) << 1;
+}
+
+/**
+ * Mirrors the first width bits of a packed row in place. The scratch buffer
+ * must be able to hold the whole row.
+ */
+void reverse_bits(uint8_t *row, int32_t width, uint8_t *scratch) {
+  const int32_t bytes = (width + 7) / 8;
+
+  for (int32_t i = 0; i < bytes; i++) {
+    scratch[i] = reverse_byte(row[bytes - 1 - i]);
+  }
+
+  // The padding bits at the end of the row are now at the start.
+  copy_bits(scratch, bytes * 8 - width, row, 0, width);
+}
+
+/**
+ * Returns the number of set bits in an area of a bilevel image, which must be
+ * within the image.
+ */
+uint64_t bilevel_count_set(Image image, Rectangle area) {
+  const int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+  uint64_t result = 0;
+
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+    result += count_bits(get_pixel_row(image, y), area.vertex[0].x, width);
+  }
+
+  return result;
+}
+
+/**
+ * Sets all the bits in an area of a bilevel image, which must be within the
+ * image, to the same value.
+ */
+void bilevel_fill(Image image, Rectangle area, bool value) {
+  const int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+    fill_bits(get_writable_pixel_row(image, y), area.vertex[0].x, width, value);
+  }
+}
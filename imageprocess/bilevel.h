@@ -0,0 +1,27 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+bool is_bilevel_image(Image image);
+bool bilevel_bit(Image image, Pixel pixel);
+uint8_t bilevel_bit_grayscale(Image image, bool bit);
+bool bilevel_is_black(Image image, Point coords);
+
+// Operations on runs of count bits of a packed row, starting at bit x.
+uint64_t count_bits(const uint8_t *row, int32_t x, int32_t count);
+void fill_bits(uint8_t *row, int32_t x, int32_t count, bool value);
+void invert_bits(uint8_t *row, int32_t x, int32_t count);
+void copy_bits(const uint8_t *source, int32_t source_x, uint8_t *target,
+               int32_t target_x, int32_t count);
+void reverse_bits(uint8_t *row, int32_t width, uint8_t *scratch);
+
+uint64_t bilevel_count_set(Image image, Rectangle area);
+void bilevel_fill(Image image, Rectangle area, bool value);
@@ -2,42 +2,366 @@
 //
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/bilevel.h"
 #include "imageprocess/blit.h"
+#include "imageprocess/integral.h"
 #include "imageprocess/interpolate.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/pixel_formats.h"
+#include "imageprocess/reductions.h"
+#include "imageprocess/resample.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
 
+// Number of pixels handled at once by the span-based loops; the scratch
+// buffers are sized accordingly and live on the stack.
+#define SPAN_SIZE 512
+
+// Returns the number of pixels visited by scan_rectangle() on the given area,
+// which is zero if the area is not normalized, as can happen for areas that
+// have been clipped to an image they do not overlap.
+static uint64_t scanned_pixels(Rectangle area) {
+  if (area.vertex[0].x > area.vertex[1].x ||
+      area.vertex[0].y > area.vertex[1].y) {
+    return 0;
+  }
+
+  return count_pixels(area);
+}
+
+// Generates the rectangle kernels for one byte pixel format that cannot be
+// built on the row reductions. They all expect an area that has already been
+// clipped to the image. Bilevel images are handled on packed bits by the
+// bilevel_* functions below instead.
+#define DEFINE_RECT_KERNELS(name, format)                                      \
+  static uint64_t name##_clear_within_brightness(                              \
+      Image image, Rectangle area, uint8_t min_brightness,                     \
+      uint8_t max_brightness) {                                                \
+    uint64_t count = 0;                                                        \
+    for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {           \
+      uint8_t *row = get_writable_pixel_row(image, y);                         \
+      for (int32_t x = area.vertex[0].x; x <= area.vertex[1].x; x++) {         \
+        const uint8_t brightness = name##_grayscale(row, x);                   \
+        if (brightness < min_brightness || brightness > max_brightness) {      \
+          continue;                                                            \
+        }                                                                      \
+        name##_set(row, x, PIXEL_WHITE, image.abs_black_threshold);            \
+        count++;                                                               \
+      }                                                                        \
+    }                                                                          \
+    return count;                                                              \
+  }
+
+FOR_EACH_BYTE_PIXEL_FORMAT(DEFINE_RECT_KERNELS)
+
+#undef DEFINE_RECT_KERNELS
+
+/**
+ * Converts count pixels of a row from one pixel format to another, going
+ * through the inline accessors of both formats so that each conversion
+ * compiles down to a single loop.
+ */
+typedef void (*RowConverter)(const uint8_t *source_row, int32_t source_x,
+                             uint8_t *target_row, int32_t target_x,
+                             int32_t count, uint8_t abs_black_threshold);
+
+// Conversions between byte formats, and from bilevel formats.
+#define FOR_EACH_ROW_CONVERTER(X)                                              \
+  X(rgb24, AV_PIX_FMT_RGB24, gray8, AV_PIX_FMT_GRAY8)                          \
+  X(gray8, AV_PIX_FMT_GRAY8, rgb24, AV_PIX_FMT_RGB24)                          \
+  X(y400a, AV_PIX_FMT_Y400A, gray8, AV_PIX_FMT_GRAY8)                          \
+  X(monowhite, AV_PIX_FMT_MONOWHITE, gray8, AV_PIX_FMT_GRAY8)                  \
+  X(monoblack, AV_PIX_FMT_MONOBLACK, gray8, AV_PIX_FMT_GRAY8)                  \
+  X(monowhite, AV_PIX_FMT_MONOWHITE, rgb24, AV_PIX_FMT_RGB24)                  \
+  X(monoblack, AV_PIX_FMT_MONOBLACK, rgb24, AV_PIX_FMT_RGB24)
+
+// Conversions to bilevel formats, which pack the target a byte at a time.
+#define FOR_EACH_BILEVEL_ROW_CONVERTER(X)                                      \
+  X(gray8, AV_PIX_FMT_GRAY8, monowhite, AV_PIX_FMT_MONOWHITE)                  \
+  X(gray8, AV_PIX_FMT_GRAY8, monoblack, AV_PIX_FMT_MONOBLACK)                  \
+  X(rgb24, AV_PIX_FMT_RGB24, monowhite, AV_PIX_FMT_MONOWHITE)                  \
+  X(rgb24, AV_PIX_FMT_RGB24, monoblack, AV_PIX_FMT_MONOBLACK)
+
+#define DEFINE_ROW_CONVERTER(source, source_format, target, target_format)     \
+  static void convert_##source##_to_##target(                                  \
+      const uint8_t *source_row, int32_t source_x, uint8_t *target_row,        \
+      int32_t target_x, int32_t count, uint8_t abs_black_threshold) {          \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      target##_set(target_row, target_x + i,                                   \
+                   source##_get(source_row, source_x + i),                     \
+                   abs_black_threshold);                                       \
+    }                                                                          \
+  }
+
+#define DEFINE_BILEVEL_ROW_CONVERTER(source, source_format, target,            \
+                                     target_format)                            \
+  static void convert_##source##_to_##target(                                  \
+      const uint8_t *source_row, int32_t source_x, uint8_t *target_row,        \
+      int32_t target_x, int32_t count, uint8_t abs_black_threshold) {          \
+    int32_t i = 0;                                                             \
+    for (; i < count && (target_x + i) % 8 != 0; i++) {                        \
+      target##_set(target_row, target_x + i,                                   \
+                   source##_get(source_row, source_x + i),                     \
+                   abs_black_threshold);                                       \
+    }                                                                          \
+    for (; i + 8 <= count; i += 8) {                                           \
+      uint8_t byte = 0;                                                        \
+      for (int32_t bit = 0; bit < 8; bit++) {                                  \
+        byte = byte << 1 |                                                     \
+               target##_bit(source##_get(source_row, source_x + i + bit),      \
+                            abs_black_threshold);                              \
+      }                                                                        \
+      target_row[(target_x + i) / 8] = byte;                                   \
+    }                                                                          \
+    for (; i < count; i++) {                                                   \
+      target##_set(target_row, target_x + i,                                   \
+                   source##_get(source_row, source_x + i),                     \
+                   abs_black_threshold);                                       \
+    }                                                                          \
+  }
+
+FOR_EACH_ROW_CONVERTER(DEFINE_ROW_CONVERTER)
+FOR_EACH_BILEVEL_ROW_CONVERTER(DEFINE_BILEVEL_ROW_CONVERTER)
+
+#undef DEFINE_ROW_CONVERTER
+#undef DEFINE_BILEVEL_ROW_CONVERTER
+
+// Returns the converter between two pixel formats, or NULL if there is none,
+// in which case the pixels have to be converted through a Pixel buffer.
+static RowConverter get_row_converter(Image source, Image target) {
+#define ROW_CONVERTER_CASE(source_name, source_format, target_name,            \
+                           target_format)                                      \
+  if (source.frame->format == source_format &&                                 \
+      target.frame->format == target_format) {                                 \
+    return convert_##source_name##_to_##target_name;                           \
+  }
+
+  FOR_EACH_ROW_CONVERTER(ROW_CONVERTER_CASE)
+  FOR_EACH_BILEVEL_ROW_CONVERTER(ROW_CONVERTER_CASE)
+
+#undef ROW_CONVERTER_CASE
+
+  return NULL;
+}
+
+// All the channel sums are the same for bilevel images, as they only contain
+// black and white pixels.
+static uint64_t bilevel_sum(Image image, Rectangle area) {
+  const uint64_t set = bilevel_count_set(image, area);
+
+  return set * bilevel_bit_grayscale(image, true) +
+         (scanned_pixels(area) - set) * bilevel_bit_grayscale(image, false);
+}
+
+static uint64_t bilevel_count_within_brightness(Image image, Rectangle area,
+                                                uint8_t min_brightness,
+                                                uint8_t max_brightness,
+                                                bool clear) {
+  const uint64_t set = bilevel_count_set(image, area);
+  uint64_t count = 0;
+  bool clear_set = false, clear_unset = false;
+
+  uint8_t brightness = bilevel_bit_grayscale(image, true);
+  if (brightness >= min_brightness && brightness <= max_brightness) {
+    count += set;
+    clear_set = clear;
+  }
+  brightness = bilevel_bit_grayscale(image, false);
+  if (brightness >= min_brightness && brightness <= max_brightness) {
+    count += scanned_pixels(area) - set;
+    clear_unset = clear;
+  }
+
+  // Clearing turns the counted pixels white; since the others already have
+  // the other bit value, a cleared area is either unchanged or uniform.
+  const bool white = bilevel_bit(image, PIXEL_WHITE);
+  if ((clear_set && !white) || (clear_unset && white)) {
+    bilevel_fill(image, area, white);
+  }
+
+  return count;
+}
+
 /**
  * Wipe a rectangular area of pixels with the defined color.
- * @return The number of pixels actually changed.
+ *
+ * Rows are filled as whole spans: with memset() for grayscale images, with
+ * fill_bits() for bilevel images, and for the other formats by storing the
+ * color once and then doubling the filled part of the first row until it
+ * covers the span, before copying it to the remaining rows.
  */
 void wipe_rectangle(Image image, Rectangle input_area, Pixel color) {
   Rectangle area = clip_rectangle(image, input_area);
 
-  scan_rectangle(area) { set_pixel(image, (Point){x, y}, color); }
+  if (scanned_pixels(area) == 0) {
+    return;
+  }
+
+  if (is_bilevel_image(image)) {
+    bilevel_fill(image, area, bilevel_bit(image, color));
+    return;
+  }
+
+  const int pixel_bytes = av_image_get_linesize(image.frame->format, 1, 0);
+  const size_t span_bytes =
+      (size_t)(area.vertex[1].x - area.vertex[0].x + 1) * pixel_bytes;
+  const ptrdiff_t offset = (ptrdiff_t)area.vertex[0].x * pixel_bytes;
+
+  if (image.frame->format == AV_PIX_FMT_GRAY8) {
+    const uint8_t value = pixel_grayscale(color);
+    for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+      memset(get_writable_pixel_row(image, y) + offset, value, span_bytes);
+    }
+    return;
+  }
+
+  uint8_t *first_span =
+      get_writable_pixel_row(image, area.vertex[0].y) + offset;
+  set_pixel(image, area.vertex[0], color);
+  for (size_t filled = pixel_bytes; filled < span_bytes; filled *= 2) {
+    memcpy(first_span + filled, first_span, min(filled, span_bytes - filled));
+  }
+
+  for (int32_t y = area.vertex[0].y + 1; y <= area.vertex[1].y; y++) {
+    memcpy(get_writable_pixel_row(image, y) + offset, first_span, span_bytes);
+  }
 }
 
 void copy_rectangle(Image source, Image target, Rectangle source_area,
                     Point target_coords) {
   Rectangle area = clip_rectangle(source, source_area);
+  Delta d = distance_between(area.vertex[0], target_coords);
+
+  // Clip the area a second time, against the target image, so that the copy
+  // loop below can work on rows without any further bounds checks.
+  Rectangle target_area = clip_rectangle(target, shift_rectangle(area, d));
+  if (scanned_pixels(area) == 0 || scanned_pixels(target_area) == 0) {
+    return;
+  }
+  area = shift_rectangle(target_area, (Delta){-d.horizontal, -d.vertical});
+
+  const int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+  const int32_t target_x = area.vertex[0].x + d.horizontal;
+
+  if (is_bilevel_image(source) && is_bilevel_image(target)) {
+    const bool invert = source.frame->format != target.frame->format;
 
-  // naive but generic implementation
-  for (int32_t sY = area.vertex[0].y, tY = target_coords.y;
-       sY <= area.vertex[1].y; sY++, tY++) {
-    for (int32_t sX = area.vertex[0].x, tX = target_coords.x;
-         sX <= area.vertex[1].x; sX++, tX++) {
-      set_pixel(target, (Point){tX, tY}, get_pixel(source, (Point){sX, sY}));
+    for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+      uint8_t *target_row = get_writable_pixel_row(target, y + d.vertical);
+      copy_bits(get_pixel_row(source, y), area.vertex[0].x, target_row,
+                target_x, width);
+      if (invert) {
+        invert_bits(target_row, target_x, width);
+      }
     }
+    return;
+  }
+
+  if (source.frame->format == target.frame->format) {
+    const int pixel_bytes = av_image_get_linesize(source.frame->format, 1, 0);
+
+    for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+      const uint8_t *source_row = get_pixel_row(source, y);
+      uint8_t *target_row = get_writable_pixel_row(target, y + d.vertical);
+      memcpy(target_row + (ptrdiff_t)target_x * pixel_bytes,
+             source_row + (ptrdiff_t)area.vertex[0].x * pixel_bytes,
+             (size_t)width * pixel_bytes);
+    }
+    return;
   }
+
+  const RowConverter convert = get_row_converter(source, target);
+  if (convert != NULL) {
+    for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+      convert(get_pixel_row(source, y), area.vertex[0].x,
+              get_writable_pixel_row(target, y + d.vertical), target_x, width,
+              target.abs_black_threshold);
+    }
+    return;
+  }
+
+  const PixelRowReader read_pixels = get_pixel_row_reader(source);
+  const PixelRowWriter write_pixels = get_pixel_row_writer(target);
+  Pixel pixels[SPAN_SIZE];
+
+  scan_rectangle_spans(area, SPAN_SIZE) {
+    read_pixels(get_pixel_row(source, y), x, length, pixels);
+    write_pixels(get_writable_pixel_row(target, y + d.vertical),
+                 x + d.horizontal, length, pixels, target.abs_black_threshold);
+  }
+}
+
+static const RowReductions *get_image_row_reductions(Image image) {
+  const RowReductions *reductions = get_row_reductions(image.frame->format);
+  if (reductions == NULL) {
+    errOutput("unknown pixel format.");
+  }
+  return reductions;
+}
+
+// Adds up a row reduction over an area, which must have been clipped to the
+// image.
+static uint64_t sum_rows(Image image, Rectangle area, RowSum reduce) {
+  const int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+  uint64_t sum = 0;
+
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+    sum += reduce(get_pixel_row(image, y), area.vertex[0].x, width);
+  }
+  return sum;
+}
+
+static uint64_t sum_grayscale(Image image, Rectangle area) {
+  uint64_t sum;
+  if (integral_sum(image, INTEGRAL_GRAYSCALE, area, &sum)) {
+    return sum;
+  }
+
+  if (is_bilevel_image(image)) {
+    return bilevel_sum(image, area);
+  }
+  return sum_rows(image, area,
+                  get_image_row_reductions(image)->sum_grayscale);
+}
+
+static uint64_t sum_lightness(Image image, Rectangle area) {
+  uint64_t sum;
+  if (integral_sum(image, INTEGRAL_LIGHTNESS, area, &sum)) {
+    return sum;
+  }
+
+  if (is_bilevel_image(image)) {
+    return bilevel_sum(image, area);
+  }
+  return sum_rows(image, area,
+                  get_image_row_reductions(image)->sum_lightness);
+}
+
+static uint64_t sum_darkness_inverse(Image image, Rectangle area) {
+  uint64_t sum;
+  if (integral_sum(image, INTEGRAL_DARKNESS_INVERSE, area, &sum)) {
+    return sum;
+  }
+
+  if (is_bilevel_image(image)) {
+    return bilevel_sum(image, area);
+  }
+  return sum_rows(image, area,
+                  get_image_row_reductions(image)->sum_darkness_inverse);
 }
 
 /**
  * Returns the average brightness of a rectangular area.
  */
 uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
-  uint64_t grayscale = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -45,9 +369,7 @@ uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    grayscale += get_pixel_grayscale(image, (Point){x, y});
-  }
+  uint64_t grayscale = sum_grayscale(image, area);
 
   return 0xFF - (grayscale / count);
 }
@@ -56,8 +378,6 @@ uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
  * Returns the inverse average lightness of a rectangular area.
  */
 uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
-  uint64_t lightness = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -65,9 +385,7 @@ uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    lightness += get_pixel_lightness(image, (Point){x, y});
-  }
+  uint64_t lightness = sum_lightness(image, area);
 
   return 0xFF - (lightness / count);
 }
@@ -76,8 +394,6 @@ uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
  * Returns the average darkness of a rectangular area.
  */
 uint8_t darkness_rect(Image image, Rectangle input_area) {
-  uint64_t darkness = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -85,9 +401,7 @@ uint8_t darkness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    darkness += get_pixel_darkness_inverse(image, (Point){x, y});
-  }
+  uint64_t darkness = sum_darkness_inverse(image, area);
 
   return 0xFF - (darkness / count);
 }
@@ -95,24 +409,88 @@ uint8_t darkness_rect(Image image, Rectangle input_area) {
 uint64_t count_pixels_within_brightness(Image image, Rectangle area,
                                         uint8_t min_brightness,
                                         uint8_t max_brightness, bool clear) {
+  Rectangle clipped_area = clip_rectangle(image, area);
   uint64_t count = 0;
 
-  scan_rectangle(area) {
-    Point p = {x, y};
-    uint8_t brightness = get_pixel_grayscale(image, p);
-    if (brightness < min_brightness || brightness > max_brightness) {
-      continue;
-    }
+  // Pixels outside of the image are considered white.
+  if (max_brightness == UINT8_MAX) {
+    count += scanned_pixels(area) - scanned_pixels(clipped_area);
+  }
+
+  uint64_t within;
+  if (!clear && integral_count_within_brightness(image, clipped_area,
+                                                 min_brightness,
+                                                 max_brightness, &within)) {
+    return count + within;
+  }
 
-    if (clear) {
-      set_pixel(image, p, PIXEL_WHITE);
+  if (is_bilevel_image(image)) {
+    return count + bilevel_count_within_brightness(image, clipped_area,
+                                                   min_brightness,
+                                                   max_brightness, clear);
+  }
+
+  if (!clear) {
+    const RowCount count_within =
+        get_image_row_reductions(image)->count_within_brightness;
+    const int32_t width =
+        clipped_area.vertex[1].x - clipped_area.vertex[0].x + 1;
+
+    for (int32_t y = clipped_area.vertex[0].y; y <= clipped_area.vertex[1].y;
+         y++) {
+      count += count_within(get_pixel_row(image, y), clipped_area.vertex[0].x,
+                            width, min_brightness, max_brightness);
     }
-    count++;
+    return count;
+  }
+
+#define CLEAR_CASE(name, format)                                               \
+  case format:                                                                 \
+    count += name##_clear_within_brightness(image, clipped_area,               \
+                                            min_brightness, max_brightness);   \
+    break;
+
+  switch (image.frame->format) {
+    FOR_EACH_BYTE_PIXEL_FORMAT(CLEAR_CASE)
+  default:
+    errOutput("unknown pixel format.");
   }
 
+#undef CLEAR_CASE
+
   return count;
 }
 
+// Wipes the parts of an area that are outside of an inner area, which must be
+// contained in it.
+static void wipe_around(Image image, Rectangle area, Rectangle inner,
+                        Pixel color) {
+  if (inner.vertex[0].y > area.vertex[0].y) {
+    wipe_rectangle(image,
+                   (Rectangle){{area.vertex[0],
+                                {area.vertex[1].x, inner.vertex[0].y - 1}}},
+                   color);
+  }
+  if (inner.vertex[1].y < area.vertex[1].y) {
+    wipe_rectangle(image,
+                   (Rectangle){{{area.vertex[0].x, inner.vertex[1].y + 1},
+                                area.vertex[1]}},
+                   color);
+  }
+  if (inner.vertex[0].x > area.vertex[0].x) {
+    wipe_rectangle(image,
+                   (Rectangle){{{area.vertex[0].x, inner.vertex[0].y},
+                                {inner.vertex[0].x - 1, inner.vertex[1].y}}},
+                   color);
+  }
+  if (inner.vertex[1].x < area.vertex[1].x) {
+    wipe_rectangle(image,
+                   (Rectangle){{{inner.vertex[1].x + 1, inner.vertex[0].y},
+                                {area.vertex[1].x, inner.vertex[1].y}}},
+                   color);
+  }
+}
+
 /**
  * Centers one area of an image inside an area of another image.
  * If the source area is smaller than the target area, is is equally
@@ -121,15 +499,10 @@ uint64_t count_pixels_within_brightness(Image image, Rectangle area,
  */
 void center_image(Image source, Image target, Point target_origin,
                   RectangleSize target_size) {
+  const Rectangle target_area = rectangle_from_size(target_origin, target_size);
   Point source_origin = POINT_ORIGIN;
   RectangleSize source_size = size_of_image(source);
 
-  if (source_size.width < target_size.width ||
-      source_size.height < target_size.height) {
-    wipe_rectangle(target, rectangle_from_size(target_origin, target_size),
-                   target.background);
-  }
-
   if (source_size.width <= target_size.width) {
     target_origin.x += (target_size.width - source_size.width) / 2;
   } else {
@@ -146,27 +519,31 @@ void center_image(Image source, Image target, Point target_origin,
   copy_rectangle(source, target,
                  rectangle_from_size(source_origin, source_size),
                  target_origin);
+
+  // Only the border around the copied area is left to fill.
+  wipe_around(target, target_area,
+              rectangle_from_size(target_origin, source_size),
+              target.background);
 }
 
-static void stretch_frame(Image source, Image target,
-                          Interpolation interpolate_type) {
-  RectangleSize source_size = size_of_image(source),
-                target_size = size_of_image(target);
-  const float horizontal_ratio =
-      (float)source_size.width / (float)target_size.width;
-  const float vertical_ratio =
-      (float)source_size.height / (float)target_size.height;
-
-  verboseLog(VERBOSE_MORE, "stretching %dx%d -> %dx%d\n", source_size.width,
-             source_size.height, target_size.width, target_size.height);
-
-  Rectangle target_area = full_image(target);
-  scan_rectangle(target_area) {
-    const Point target_coords = {x, y};
-    const FloatPoint source_coords = {x * horizontal_ratio, y * vertical_ratio};
-    set_pixel(target, target_coords,
-              interpolate(source, source_coords, interpolate_type));
+/**
+ * Converts a bilevel image to grayscale before it is interpolated, as the
+ * interpolation produces intermediate gray levels that must not be lost to
+ * thresholding before the output is written. Nearest-neighbour interpolation
+ * only ever produces existing pixels, so it can keep working on bits.
+ */
+void prepare_for_interpolation(Image *pImage, Interpolation interpolate_type) {
+  if (!is_bilevel_image(*pImage) || interpolate_type == INTERP_NN) {
+    return;
   }
+
+  verboseLog(VERBOSE_DEBUG, "converting bilevel image to grayscale.\n");
+
+  Image converted = create_image(size_of_image(*pImage), AV_PIX_FMT_GRAY8,
+                                 false, pImage->background,
+                                 pImage->abs_black_threshold);
+  copy_rectangle(*pImage, converted, full_image(*pImage), POINT_ORIGIN);
+  replace_image(pImage, &converted);
 }
 
 void stretch_and_replace(Image *pImage, RectangleSize size,
@@ -174,9 +551,15 @@ void stretch_and_replace(Image *pImage, RectangleSize size,
   if (compare_sizes(size_of_image(*pImage), size) == 0)
     return;
 
+  verboseLog(VERBOSE_MORE, "stretching %dx%d -> %dx%d\n",
+             size_of_image(*pImage).width, size_of_image(*pImage).height,
+             size.width, size.height);
+
+  prepare_for_interpolation(pImage, interpolate_type);
+
   Image target = create_compatible_image(*pImage, size, false);
 
-  stretch_frame(*pImage, target, interpolate_type);
+  resample_image(*pImage, target, interpolate_type);
   replace_image(pImage, &target);
 }
 
@@ -220,6 +603,111 @@ void resize_and_replace(Image *pImage, RectangleSize size,
   replace_image(pImage, &resized);
 }
 
+// Number of target columns that flip_rotate_90() fills in one pass over the
+// target rows. The source rows they are read from stay in the cache for the
+// whole pass, so that both images are accessed a cache line at a time rather
+// than a pixel at a time.
+#define ROTATION_STRIP_SIZE 64
+
+// Generates the 90 degrees rotation kernel for one byte pixel format. Target
+// column xx is source row y, and target row yy is source column x.
+#define DEFINE_ROTATE_KERNEL(name, format)                                     \
+  static void name##_flip_rotate_90(Image source, Image target,                \
+                                    RotationDirection direction) {             \
+    const RectangleSize source_size = size_of_image(source);                   \
+    const uint8_t *source_rows[ROTATION_STRIP_SIZE];                           \
+                                                                               \
+    for (int32_t strip = 0; strip < source_size.height;                        \
+         strip += ROTATION_STRIP_SIZE) {                                       \
+      const int32_t strip_width =                                              \
+          min(ROTATION_STRIP_SIZE, source_size.height - strip);                \
+      for (int32_t i = 0; i < strip_width; i++) {                              \
+        const int32_t xx = strip + i;                                          \
+        source_rows[i] = get_pixel_row(                                        \
+            source, (direction > 0) ? source_size.height - 1 - xx : xx);       \
+      }                                                                        \
+                                                                               \
+      for (int32_t yy = 0; yy < source_size.width; yy++) {                     \
+        const int32_t x = (direction > 0) ? yy : source_size.width - 1 - yy;   \
+        uint8_t *target_row = get_writable_pixel_row(target, yy);              \
+        for (int32_t i = 0; i < strip_width; i++) {                            \
+          name##_set(target_row, strip + i, name##_get(source_rows[i], x),     \
+                     target.abs_black_threshold);                              \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  }
+
+FOR_EACH_BYTE_PIXEL_FORMAT(DEFINE_ROTATE_KERNEL)
+
+#undef DEFINE_ROTATE_KERNEL
+
+/**
+ * Transposes a matrix of 8x8 bits, stored one row per byte with the first row
+ * in the most significant byte, and the first column in the most significant
+ * bit of each byte.
+ */
+static inline uint64_t transpose_bits_8x8(uint64_t x) {
+  uint64_t t;
+
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+
+  return x;
+}
+
+// Rotates a bilevel image a block of 8x8 pixels at a time: each byte of the
+// target is one column of a block made of one byte of eight source rows.
+static void bilevel_flip_rotate_90(Image source, Image target,
+                                   RotationDirection direction) {
+  const RectangleSize source_size = size_of_image(source);
+  const int32_t source_bytes = (source_size.width + 7) / 8;
+  const int32_t target_bytes = (source_size.height + 7) / 8;
+  uint8_t *target_rows[ROTATION_STRIP_SIZE];
+
+  // Each strip covers ROTATION_STRIP_SIZE source columns, which are the
+  // target rows written, a byte at a time, while moving down the source.
+  for (int32_t strip = 0; strip < source_bytes;
+       strip += ROTATION_STRIP_SIZE / 8) {
+    const int32_t strip_bytes =
+        min(ROTATION_STRIP_SIZE / 8, source_bytes - strip);
+    const int32_t strip_width =
+        min(strip_bytes * 8, source_size.width - strip * 8);
+    for (int32_t i = 0; i < strip_width; i++) {
+      const int32_t x = strip * 8 + i;
+      target_rows[i] = get_writable_pixel_row(
+          target, (direction > 0) ? x : source_size.width - 1 - x);
+    }
+
+    for (int32_t k = 0; k < target_bytes; k++) {
+      // Bit r of the target bytes comes from the source row rows[r], which
+      // is NULL past the last one.
+      const uint8_t *rows[8];
+      for (int32_t r = 0; r < 8; r++) {
+        const int32_t xx = k * 8 + r;
+        rows[r] = get_pixel_row(
+            source, (direction > 0) ? source_size.height - 1 - xx : xx);
+      }
+
+      for (int32_t b = 0; b < strip_bytes; b++) {
+        uint64_t block = 0;
+        for (int32_t r = 0; r < 8; r++) {
+          block = block << 8 | (rows[r] != NULL ? rows[r][strip + b] : 0);
+        }
+        block = transpose_bits_8x8(block);
+
+        for (int32_t c = 0; c < 8 && b * 8 + c < strip_width; c++) {
+          target_rows[b * 8 + c][k] = block >> (56 - 8 * c);
+        }
+      }
+    }
+  }
+}
+
 void flip_rotate_90(Image *pImage, RotationDirection direction) {
   RectangleSize image_size = size_of_image(*pImage);
 
@@ -229,26 +717,66 @@ void flip_rotate_90(Image *pImage, RotationDirection direction) {
       (RectangleSize){.width = image_size.height, .height = image_size.width},
       false);
 
-  for (int y = 0; y < image_size.height; y++) {
-    const int xx =
-        ((direction > 0) ? image_size.height - 1 : 0) - y * direction;
-    for (int x = 0; x < image_size.width; x++) {
-      const int yy =
-          ((direction < 0) ? image_size.width - 1 : 0) + x * direction;
+#define ROTATE_CASE(name, format)                                              \
+  case format:                                                                 \
+    name##_flip_rotate_90(*pImage, newimage, direction);                       \
+    break;
+
+  switch (pImage->frame->format) {
+    FOR_EACH_BYTE_PIXEL_FORMAT(ROTATE_CASE)
+  case AV_PIX_FMT_MONOWHITE:
+  case AV_PIX_FMT_MONOBLACK:
+    bilevel_flip_rotate_90(*pImage, newimage, direction);
+    break;
+  default:
+    errOutput("unknown pixel format.");
+  }
 
-      Point point1 = {x, y};
-      Point point2 = {xx, yy};
+#undef ROTATE_CASE
+
+  replace_image(pImage, &newimage);
+}
 
-      set_pixel(newimage, point2, get_pixel(*pImage, point1));
+static void bilevel_mirror(Image image, Direction direction) {
+  RectangleSize image_size = size_of_image(image);
+  const size_t row_bytes = (image_size.width + 7) / 8;
+  uint8_t *scratch = malloc(row_bytes);
+
+  if (scratch == NULL) {
+    errOutput("unable to allocate mirror buffer.");
+  }
+
+  if (direction.vertical) {
+    for (int32_t y = 0; y < image_size.height / 2; y++) {
+      uint8_t *top = get_writable_pixel_row(image, y);
+      uint8_t *bottom =
+          get_writable_pixel_row(image, image_size.height - 1 - y);
+
+      memcpy(scratch, top, row_bytes);
+      memcpy(top, bottom, row_bytes);
+      memcpy(bottom, scratch, row_bytes);
     }
   }
-  replace_image(pImage, &newimage);
+
+  if (direction.horizontal) {
+    for (int32_t y = 0; y < image_size.height; y++) {
+      reverse_bits(get_writable_pixel_row(image, y), image_size.width,
+                   scratch);
+    }
+  }
+
+  free(scratch);
 }
 
 void mirror(Image image, Direction direction) {
   Rectangle source = {{POINT_ORIGIN, POINT_INFINITY}};
   RectangleSize image_size = size_of_image(image);
 
+  if (is_bilevel_image(image)) {
+    bilevel_mirror(image, direction);
+    return;
+  }
+
   if (direction.horizontal && !direction.vertical) {
     source.vertex[1].x = (image_size.width - 1) / 2;
   }
@@ -281,12 +809,74 @@ void mirror(Image image, Direction direction) {
   }
 }
 
-void shift_image(Image *pImage, Delta d) {
-  // allocate new buffer's memory
-  Image newimage =
-      create_compatible_image(*pImage, size_of_image(*pImage), true);
+// Moves count pixels from one row of the image to another one, or to a
+// different position of the same row.
+static void move_pixels(Image image, Point source, Point target, int32_t count,
+                        uint8_t *scratch) {
+  const uint8_t *source_row = get_pixel_row(image, source.y);
+  uint8_t *target_row = get_writable_pixel_row(image, target.y);
+
+  if (is_bilevel_image(image)) {
+    // copy_bits() cannot move bits within the same row.
+    if (source.y == target.y) {
+      memcpy(scratch, source_row, (image.frame->width + 7) / 8);
+      source_row = scratch;
+    }
+    copy_bits(source_row, source.x, target_row, target.x, count);
+    return;
+  }
 
-  copy_rectangle(*pImage, newimage, full_image(*pImage),
-                 shift_point(POINT_ORIGIN, d));
-  replace_image(pImage, &newimage);
+  const int pixel_bytes = av_image_get_linesize(image.frame->format, 1, 0);
+  memmove(target_row + (ptrdiff_t)target.x * pixel_bytes,
+          source_row + (ptrdiff_t)source.x * pixel_bytes,
+          (size_t)count * pixel_bytes);
+}
+
+/**
+ * Shifts the image in place: the rows are moved starting from the side the
+ * image is shifted towards, so that no row is overwritten before it has been
+ * moved, and the exposed areas are filled with the background.
+ */
+void shift_image(Image image, Delta d) {
+  const RectangleSize size = size_of_image(image);
+  const int32_t width = size.width - abs(d.horizontal);
+  const int32_t height = size.height - abs(d.vertical);
+
+  if (width <= 0 || height <= 0) {
+    wipe_rectangle(image, full_image(image), image.background);
+    return;
+  }
+
+  uint8_t *scratch = NULL;
+  if (is_bilevel_image(image) && d.vertical == 0) {
+    scratch = malloc((size.width + 7) / 8);
+    if (scratch == NULL) {
+      errOutput("unable to allocate shift buffer.");
+    }
+  }
+
+  const int32_t source_x = max(-d.horizontal, 0);
+  for (int32_t i = 0; i < height; i++) {
+    const int32_t y = (d.vertical > 0) ? size.height - 1 - i : i;
+    move_pixels(image, (Point){source_x, y - d.vertical},
+                (Point){source_x + d.horizontal, y}, width, scratch);
+  }
+
+  free(scratch);
+
+  // Fill the columns and rows exposed by the shift.
+  if (d.horizontal != 0) {
+    wipe_rectangle(image,
+                   rectangle_from_size(
+                       (Point){(d.horizontal > 0) ? 0 : width, 0},
+                       (RectangleSize){abs(d.horizontal), size.height}),
+                   image.background);
+  }
+  if (d.vertical != 0) {
+    wipe_rectangle(image,
+                   rectangle_from_size(
+                       (Point){0, (d.vertical > 0) ? 0 : height},
+                       (RectangleSize){size.width, abs(d.vertical)}),
+                   image.background);
+  }
 }
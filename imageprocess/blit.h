@@ -27,6 +27,8 @@ static const RotationDirection ROTATE_ANTICLOCKWISE = -1;
 void center_image(Image source, Image target, Point target_origin,
                   RectangleSize target_size);
 
+void prepare_for_interpolation(Image *pImage, Interpolation interpolate_type);
+
 void stretch_and_replace(Image *pImage, RectangleSize size,
                          Interpolation interpolate_type);
 
@@ -40,4 +42,4 @@ void flip_rotate_90(Image *pImage, RotationDirection direction);
 void mirror(Image image, Direction direction);
 
 // Shifts the image.
-void shift_image(Image *pImage, Delta d);
+void shift_image(Image image, Delta d);
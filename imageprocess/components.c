@@ -0,0 +1,157 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "imageprocess/components.h"
+#include "imageprocess/pixel.h"
+#include "lib/logging.h"
+#include "lib/math_util.h"
+
+/**
+ * Connected-component labeling, working on runs of dark pixels rather than on
+ * single pixels.
+ *
+ * The first pass splits each row into runs, and joins every run with the runs
+ * of the previous row it touches, diagonally included, in a union-find forest
+ * stored in the component field of the runs. The second pass numbers the
+ * roots of the forest and accumulates the size and bounding box of each
+ * component. Both passes are linear, and the memory used only depends on the
+ * number of runs.
+ */
+
+// Initial number of runs allocated for a table.
+#define INITIAL_RUNS 1024
+
+static size_t find_root(ComponentRun *runs, size_t run) {
+  while (runs[run].component != run) {
+    // Path halving.
+    runs[run].component = runs[runs[run].component].component;
+    run = runs[run].component;
+  }
+  return run;
+}
+
+// Joins two trees under the root of the earliest run, so that roots are always
+// the first run of their component.
+static void join_runs(ComponentRun *runs, size_t a, size_t b) {
+  a = find_root(runs, a);
+  b = find_root(runs, b);
+  if (a < b) {
+    runs[b].component = a;
+  } else if (b < a) {
+    runs[a].component = b;
+  }
+}
+
+static void append_run(ComponentTable *table, size_t *allocated,
+                       ComponentRun run) {
+  if (table->runs_count == *allocated) {
+    *allocated *= 2;
+    table->runs = realloc(table->runs, *allocated * sizeof(ComponentRun));
+    if (table->runs == NULL) {
+      errOutput("unable to allocate component runs.");
+    }
+  }
+  table->runs[table->runs_count++] = run;
+}
+
+/**
+ * Labels the 8-connected components of the pixels of the image whose
+ * lightness is lower than min_white_level.
+ */
+ComponentTable find_dark_components(Image image, uint8_t min_white_level) {
+  const RectangleSize size = size_of_image(image);
+  ComponentTable table = {0};
+  size_t allocated = INITIAL_RUNS;
+
+  uint8_t *values = malloc(size.width);
+  table.runs = malloc(allocated * sizeof(ComponentRun));
+  if (values == NULL || table.runs == NULL) {
+    errOutput("unable to allocate component runs.");
+  }
+
+  size_t previous_row = 0; // first run of the previous row
+  for (int32_t y = 0; y < size.height; y++) {
+    const size_t current_row = table.runs_count;
+
+    get_lightness_span(image, (Point){0, y}, size.width, values);
+    for (int32_t x = 0; x < size.width; x++) {
+      if (values[x] >= min_white_level) {
+        continue;
+      }
+
+      ComponentRun run = {.y = y, .first_x = x, .component = table.runs_count};
+      while (x + 1 < size.width && values[x + 1] < min_white_level) {
+        x++;
+      }
+      run.last_x = x;
+      append_run(&table, &allocated, run);
+    }
+
+    // Runs of both rows are sorted, so the touching pairs can be found by
+    // walking them together.
+    size_t above = previous_row;
+    for (size_t run = current_row; run < table.runs_count; run++) {
+      while (above < current_row &&
+             table.runs[above].last_x < table.runs[run].first_x - 1) {
+        above++;
+      }
+      for (size_t other = above; other < current_row &&
+                                 table.runs[other].first_x <=
+                                     table.runs[run].last_x + 1;
+           other++) {
+        join_runs(table.runs, run, other);
+      }
+    }
+
+    previous_row = current_row;
+  }
+  free(values);
+
+  // The parent of a run always comes before it, so a single pass in order
+  // replaces the parents with the numbers of their components, roots being
+  // numbered in the order of the first pixel of their component.
+  table.components = malloc(max(table.runs_count, (size_t)1) *
+                            sizeof(Component));
+  if (table.components == NULL) {
+    errOutput("unable to allocate components.");
+  }
+
+  for (size_t i = 0; i < table.runs_count; i++) {
+    ComponentRun *run = &table.runs[i];
+    const size_t parent = run->component;
+    Component *component;
+
+    if (parent == i) {
+      run->component = table.components_count++;
+      component = &table.components[run->component];
+      *component = (Component){
+          .size = 0,
+          .bounds = {{{run->first_x, run->y}, {run->last_x, run->y}}},
+      };
+    } else {
+      run->component = table.runs[parent].component;
+      component = &table.components[run->component];
+    }
+
+    component->size += run->last_x - run->first_x + 1;
+    component->bounds.vertex[0].x =
+        min(component->bounds.vertex[0].x, run->first_x);
+    component->bounds.vertex[1].x =
+        max(component->bounds.vertex[1].x, run->last_x);
+    component->bounds.vertex[1].y = run->y;
+  }
+
+  return table;
+}
+
+void free_component_table(ComponentTable *table) {
+  free(table->runs);
+  free(table->components);
+  *table = (ComponentTable){0};
+}
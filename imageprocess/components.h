@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+// A horizontal run of pixels belonging to a component.
+typedef struct {
+  int32_t y;
+  int32_t first_x;
+  int32_t last_x;
+  size_t component;
+} ComponentRun;
+
+typedef struct {
+  uint64_t size;
+  Rectangle bounds;
+} Component;
+
+// The 8-connected components of the dark pixels of an image, each one made of
+// runs. Runs are sorted by row then column, and components by their first
+// pixel in the same order.
+typedef struct {
+  size_t runs_count;
+  ComponentRun *runs;
+  size_t components_count;
+  Component *components;
+} ComponentTable;
+
+ComponentTable find_dark_components(Image image, uint8_t min_white_level);
+void free_component_table(ComponentTable *table);
@@ -3,37 +3,137 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 
+#include <libavutil/frame.h>
 #include <libavutil/mathematics.h> // for M_PI
 
 #include "constants.h"
+#include "imageprocess/bilevel.h"
 #include "imageprocess/blit.h"
 #include "imageprocess/deskew.h"
 #include "imageprocess/interpolate.h"
 #include "imageprocess/pixel.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
+#include "lib/parallel.h"
 
 // maximum pixel count of virtual line to detect rotation with
 #define MAX_ROTATION_SCAN_SIZE 10000
 
+// number of rotated pixels computed before they are written back together
+#define ROTATION_SPAN_SIZE 512
+
+// number of sheared pixels computed before they are written back together
+#define SHEAR_SPAN_SIZE 512
+
 static inline float degreesToRadians(float d) { return d * M_PI / 180.0; }
 
-bool validate_deskew_parameters(DeskewParameters *params, float deskewScanRange,
-                                float deskewScanStep, float deskewScanDeviation,
-                                int deskewScanSize, float deskewScanDepth,
-                                Edges deskewScanEdges) {
+bool validate_deskew_parameters(DeskewParameters *params,
+                                DeskewMethod deskewMethod,
+                                float deskewScanRange, float deskewScanStep,
+                                float deskewScanCoarseStep,
+                                bool deskewScanSubstep,
+                                float deskewScanDeviation, int deskewScanSize,
+                                float deskewScanDepth, Edges deskewScanEdges,
+                                float deskewShearLimit) {
+  if (deskewScanCoarseStep < 0 || deskewShearLimit < 0) {
+    return false;
+  }
+  // The coarse search counts its stride in scan steps.
+  if (deskewScanCoarseStep > 0 && deskewScanStep <= 0) {
+    return false;
+  }
+
   *params = (DeskewParameters){
+      .method = deskewMethod,
       .deskewScanRangeRad = degreesToRadians(deskewScanRange),
       .deskewScanStepRad = degreesToRadians(deskewScanStep),
+      .deskewScanCoarseStepRad = degreesToRadians(deskewScanCoarseStep),
+      .deskewScanSubstep = deskewScanSubstep,
       .deskewScanDeviationRad = degreesToRadians(deskewScanDeviation),
       .deskewScanSize = deskewScanSize,
       .deskewScanDepth = deskewScanDepth,
-      .scan_edges = deskewScanEdges};
+      .scan_edges = deskewScanEdges,
+      .deskewShearLimitRad = degreesToRadians(deskewShearLimit)};
 
   return true;
 }
 
+/**
+ * Darkness of the pixels of a mask (255 minus their darkness inverse), so that
+ * the rotation scans can sample them without bounds checks or format switches.
+ */
+typedef struct {
+  Rectangle area;
+  int32_t stride;
+  uint8_t *darkness;
+} DarknessPlane;
+
+static DarknessPlane create_darkness_plane(Image image, Rectangle mask) {
+  const Rectangle area = normalize_rectangle(mask);
+  const RectangleSize size = size_of_rectangle(area);
+  DarknessPlane plane = {
+      .area = area,
+      .stride = size.width,
+      .darkness = malloc((size_t)size.width * size.height),
+  };
+  if (plane.darkness == NULL) {
+    errOutput("unable to allocate deskew darkness plane.");
+  }
+
+  for (int32_t y = 0; y < size.height; y++) {
+    uint8_t *row = plane.darkness + (size_t)y * plane.stride;
+    get_darkness_inverse_span(
+        image, (Point){area.vertex[0].x, area.vertex[0].y + y}, size.width,
+        row);
+    for (int32_t x = 0; x < size.width; x++) {
+      row[x] = UINT8_MAX - row[x];
+    }
+  }
+
+  return plane;
+}
+
+/**
+ * Returns the range of the entries of a monotonic array of coordinates that,
+ * moved by distance, fall within [low, high]. The range starts at *first, and
+ * its length is returned.
+ */
+static size_t clip_line(const int32_t *coords, size_t count, int32_t distance,
+                        int32_t low, int32_t high, size_t *first) {
+  // Looking at decreasing coordinates negated makes them increasing.
+  const int32_t direction =
+      (count > 0 && coords[0] > coords[count - 1]) ? -1 : 1;
+  const int32_t bounds[2] = {
+      direction > 0 ? low - distance : distance - high,
+      direction > 0 ? high - distance : distance - low,
+  };
+  size_t ends[2];
+
+  // ends[0] is the first entry not below bounds[0], ends[1] the first entry
+  // above bounds[1].
+  for (int i = 0; i < 2; i++) {
+    size_t begin = 0, end = count;
+    while (begin < end) {
+      const size_t middle = begin + (end - begin) / 2;
+      const int32_t coord = direction * coords[middle];
+      if (i == 0 ? coord < bounds[0] : coord <= bounds[1]) {
+        begin = middle + 1;
+      } else {
+        end = middle;
+      }
+    }
+    ends[i] = begin;
+  }
+
+  *first = ends[0];
+  return ends[1] > ends[0] ? ends[1] - ends[0] : 0;
+}
+
 /**
  * Returns the maximum peak value that occurs when shifting a rotated virtual
  * line above the image, starting from one edge of an area and moving towards
@@ -41,10 +141,15 @@ bool validate_deskew_parameters(DeskewParameters *params, float deskewScanRange,
  * difference in the average blackness of pixels that occurs between two single
  * shifting steps.
  *
+ * The line is only rasterized once: the pixels it covers are kept as offsets
+ * into the darkness plane of the area, and each shifting step clips them to the
+ * area and moves them by a constant offset.
+ *
  * @param m ascending slope of the virtually shifted (m=tan(angle)). Mind that
  * this is negative for negative radians.
  */
-static int detect_edge_rotation_peak(Image image, const Rectangle mask,
+static int detect_edge_rotation_peak(const DarknessPlane *plane,
+                                     const Rectangle mask,
                                      const DeskewParameters params, Delta shift,
                                      float m) {
   RectangleSize size = size_of_rectangle(mask);
@@ -57,7 +162,6 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
   float stepX;
   float stepY;
   int dep;
-  int pixel;
   int blackness;
   int lastBlackness = 0;
   int diff = 0;
@@ -66,8 +170,9 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
   int maxDepth;
   int accumulatedBlackness = 0;
   int deskewScanSize = params.deskewScanSize;
+  const bool horizontal = shift.vertical == 0;
 
-  if (shift.vertical == 0) { // horizontal detection
+  if (horizontal) { // horizontal detection
     if (deskewScanSize == -1) {
       deskewScanSize = size.height;
     }
@@ -100,14 +205,36 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
     stepY = -m; // (line goes upwards for negative degrees)
   }
 
-  Point p[deskewScanSize];
+  // Rasterize the rotated line in its first unshifted position. Each pixel is
+  // split into the coordinate that moves with shifting, and the one that does
+  // not, so that only the pixels within the area along the latter are kept.
+  const Rectangle area = plane->area;
+  const int32_t low = horizontal ? area.vertex[0].x : area.vertex[0].y;
+  const int32_t high = horizontal ? area.vertex[1].x : area.vertex[1].y;
+  const int32_t distance = horizontal ? shift.horizontal : shift.vertical;
+  const ptrdiff_t step =
+      horizontal ? distance : (ptrdiff_t)distance * plane->stride;
+  int32_t *coords = malloc(max(deskewScanSize, 1) * sizeof(int32_t));
+  ptrdiff_t *offsets = malloc(max(deskewScanSize, 1) * sizeof(ptrdiff_t));
+  size_t count = 0;
+  if (coords == NULL || offsets == NULL) {
+    errOutput("unable to allocate deskew scan line.");
+  }
 
-  // fill buffer with coordinates for rotated line in first unshifted position
   for (int lineStep = 0; lineStep < deskewScanSize; lineStep++) {
-    p[lineStep].x = (int)X;
-    p[lineStep].y = (int)Y;
+    const Point p = {(int)X, (int)Y};
     X += stepX;
     Y += stepY;
+
+    const int32_t fixed = horizontal ? p.y : p.x;
+    if (fixed < (horizontal ? area.vertex[0].y : area.vertex[0].x) ||
+        fixed > (horizontal ? area.vertex[1].y : area.vertex[1].x)) {
+      continue;
+    }
+    coords[count] = horizontal ? p.x : p.y;
+    offsets[count] = (ptrdiff_t)(p.y - area.vertex[0].y) * plane->stride +
+                     (p.x - area.vertex[0].x);
+    count++;
   }
 
   // now scan for edge, modify coordinates in buffer to shift line into search
@@ -117,14 +244,14 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
   for (dep = 0; (accumulatedBlackness < maxBlacknessAbs) && (dep < maxDepth);
        dep++) {
     // calculate blackness of virtual line
+    size_t first;
+    const size_t visible =
+        clip_line(coords, count, dep * distance, low, high, &first);
+    const ptrdiff_t moved = dep * step;
+
     blackness = 0;
-    for (int lineStep = 0; lineStep < deskewScanSize; lineStep++) {
-      Point pt = p[lineStep];
-      p[lineStep] = shift_point(pt, shift);
-      if (point_in_rectangle(pt, mask)) {
-        pixel = get_pixel_darkness_inverse(image, pt);
-        blackness += (255 - pixel);
-      }
+    for (size_t i = first; i < first + visible; i++) {
+      blackness += plane->darkness[offsets[i] + moved];
     }
     diff = blackness - lastBlackness;
     lastBlackness = blackness;
@@ -133,6 +260,9 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
     }
     accumulatedBlackness += blackness;
   }
+  free(offsets);
+  free(coords);
+
   if (dep < maxDepth) { // has not terminated only because middle was reached
     return maxDiff;
   } else {
@@ -140,141 +270,867 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
   }
 }
 
+// The edges scanned for rotation, in the order their results are reported.
+static const struct {
+  const char *name;
+  Delta shift;
+  bool negate; // the rotation of horizontal edges is detected reversed
+} scan_edges[] = {
+    {"left", DELTA_RIGHTWARD, false},
+    {"top", DELTA_DOWNWARD, true},
+    {"right", DELTA_LEFTWARD, false},
+    {"bottom", DELTA_UPWARD, true},
+};
+
+static bool edge_enabled(Edges edges, size_t edge) {
+  switch (edge) {
+  case 0:
+    return edges.left;
+  case 1:
+    return edges.top;
+  case 2:
+    return edges.right;
+  default:
+    return edges.bottom;
+  }
+}
+
 /**
- * Detects rotation at one edge of the area specified by left, top, right,
- * bottom. Which of the four edges to take depends on whether shiftX or shiftY
- * is non-zero, and what sign this shifting value has.
+ * Every peak needed to detect the rotation of a set of masks, one for each
+ * combination of mask, scanned edge and test angle; a line of peaks holds the
+ * test angles of one edge of one mask. The peaks are independent read-only
+ * scans of the image, so they are computed in parallel, and stored so that
+ * they can be compared in the same order as a serial scan would.
  */
-static float detect_edge_rotation(Image image, const Rectangle mask,
-                                  const DeskewParameters params, Delta shift) {
-  // either shiftX or shiftY is 0, the other value is -i|+i
-  // depending on shiftX/shiftY the start edge for shifting is determined
-  int max_peak = 0;
-  float detected_rotation = 0.0;
+typedef struct {
+  const Rectangle *masks;
+  DarknessPlane *planes;
+  DeskewParameters params;
+  size_t edges[4];
+  size_t edges_count;
+  float *angles;
+  size_t angles_count;
+  size_t lines_count;
+  int *peaks;
+  size_t *jobs; // indexes of the peaks queued for scanning
+  size_t jobs_count;
+} RotationScan;
+
+// Peaks of the test angles that have not been scanned, or not yet.
+#define PEAK_NOT_SCANNED -1
+#define PEAK_QUEUED -2
+
+// Number of best angles of a coarse scan that get refined.
+#define COARSE_SCAN_CANDIDATES 3
+
+static void scan_rotation_peak(void *arg, size_t job) {
+  RotationScan *scan = arg;
+  const size_t index = scan->jobs[job];
+  const size_t angle = index % scan->angles_count;
+  const size_t edge = (index / scan->angles_count) % scan->edges_count;
+  const size_t mask = index / scan->angles_count / scan->edges_count;
+
+  scan->peaks[index] = detect_edge_rotation_peak(
+      &scan->planes[mask], scan->masks[mask], scan->params,
+      scan_edges[scan->edges[edge]].shift, tanf(scan->angles[angle]));
+}
+
+// Test angles increase in absolute value, alternating between +/- sign, so
+// that the smallest rotation wins among equal peaks.
+static float next_test_angle(float rotation, const DeskewParameters params) {
+  return (rotation >= 0.0) ? -(rotation + params.deskewScanStepRad)
+                           : -rotation;
+}
+
+static float *rotation_test_angles(const DeskewParameters params,
+                                   size_t *count) {
+  *count = 0;
+  for (float rotation = 0.0; rotation <= params.deskewScanRangeRad;
+       rotation = next_test_angle(rotation, params)) {
+    (*count)++;
+  }
+
+  float *angles = malloc(max(*count, (size_t)1) * sizeof(float));
+  if (angles == NULL) {
+    errOutput("unable to allocate deskew test angles.");
+  }
 
-  // iteratively increase test angle, alternating between +/- sign while
-  // increasing absolute value
+  size_t n = 0;
   for (float rotation = 0.0; rotation <= params.deskewScanRangeRad;
-       rotation = (rotation >= 0.0) ? -(rotation + params.deskewScanStepRad)
-                                    : -rotation) {
-    float m = tanf(rotation);
-    int peak = detect_edge_rotation_peak(image, mask, params, shift, m);
-    if (peak > max_peak) {
-      detected_rotation = rotation;
-      max_peak = peak;
+       rotation = next_test_angle(rotation, params)) {
+    angles[n++] = rotation;
+  }
+
+  return angles;
+}
+
+// Converts between the index of a test angle and its signed number of steps
+// from 0.
+static size_t angle_of_step(int32_t step) {
+  return step < 0 ? (size_t)(-step) * 2 - 1 : (size_t)step * 2;
+}
+
+static int32_t step_of_angle(size_t angle) {
+  return (angle % 2) ? -(int32_t)((angle + 1) / 2) : (int32_t)(angle / 2);
+}
+
+static int peak_at(const RotationScan *scan, size_t line, int32_t step) {
+  const size_t angle = angle_of_step(step);
+  if (angle >= scan->angles_count) {
+    return PEAK_NOT_SCANNED;
+  }
+  return scan->peaks[line * scan->angles_count + angle];
+}
+
+static void queue_peak(RotationScan *scan, size_t line, int32_t step) {
+  const size_t angle = angle_of_step(step);
+  if (angle >= scan->angles_count) {
+    return;
+  }
+
+  const size_t index = line * scan->angles_count + angle;
+  if (scan->peaks[index] == PEAK_NOT_SCANNED) {
+    scan->peaks[index] = PEAK_QUEUED;
+    scan->jobs[scan->jobs_count++] = index;
+  }
+}
+
+static void scan_queued_peaks(RotationScan *scan) {
+  parallel_for(scan->jobs_count, scan_rotation_peak, scan);
+  scan->jobs_count = 0;
+}
+
+// Whether step a is preferred over step b, as it would be in a serial scan.
+static bool better_step(const RotationScan *scan, size_t line, int32_t a,
+                        int32_t b) {
+  const int peak_a = peak_at(scan, line, a);
+  const int peak_b = peak_at(scan, line, b);
+  return peak_a > peak_b ||
+         (peak_a == peak_b && angle_of_step(a) < angle_of_step(b));
+}
+
+/**
+ * Scans a coarse subset of the test angles, one every stride steps, then
+ * refines the best candidates by repeatedly scanning halfway between them and
+ * their neighbours, until the neighbouring test angles are reached.
+ */
+static void scan_coarse_to_fine(RotationScan *scan, int32_t stride) {
+  int32_t *centers =
+      malloc(scan->lines_count * COARSE_SCAN_CANDIDATES * sizeof(int32_t));
+  if (centers == NULL) {
+    errOutput("unable to allocate deskew candidates.");
+  }
+
+  for (size_t line = 0; line < scan->lines_count; line++) {
+    for (size_t angle = 0; angle < scan->angles_count; angle++) {
+      if (step_of_angle(angle) % stride == 0) {
+        queue_peak(scan, line, step_of_angle(angle));
+      }
+    }
+  }
+  scan_queued_peaks(scan);
+
+  for (size_t line = 0; line < scan->lines_count; line++) {
+    int32_t *line_centers = &centers[line * COARSE_SCAN_CANDIDATES];
+
+    for (size_t n = 0; n < COARSE_SCAN_CANDIDATES; n++) {
+      // with fewer coarse angles than candidates, the best one is repeated
+      line_centers[n] = (n > 0) ? line_centers[0] : 0;
+      bool found = false;
+
+      for (size_t angle = 0; angle < scan->angles_count; angle++) {
+        const int32_t step = step_of_angle(angle);
+        bool taken = step % stride != 0;
+        for (size_t other = 0; other < n; other++) {
+          taken = taken || line_centers[other] == step;
+        }
+        if (!taken &&
+            (!found || better_step(scan, line, step, line_centers[n]))) {
+          line_centers[n] = step;
+          found = true;
+        }
+      }
+    }
+  }
+
+  for (int32_t radius = stride; radius > 1;) {
+    const int32_t half = (radius + 1) / 2;
+
+    for (size_t line = 0; line < scan->lines_count; line++) {
+      for (size_t n = 0; n < COARSE_SCAN_CANDIDATES; n++) {
+        const int32_t center = centers[line * COARSE_SCAN_CANDIDATES + n];
+        queue_peak(scan, line, center - half);
+        queue_peak(scan, line, center + half);
+      }
+    }
+    scan_queued_peaks(scan);
+
+    for (size_t line = 0; line < scan->lines_count; line++) {
+      for (size_t n = 0; n < COARSE_SCAN_CANDIDATES; n++) {
+        int32_t *center = &centers[line * COARSE_SCAN_CANDIDATES + n];
+        const int32_t low = *center - half;
+        const int32_t high = *center + half;
+        if (better_step(scan, line, low, *center)) {
+          *center = low;
+        }
+        if (better_step(scan, line, high, *center)) {
+          *center = high;
+        }
+      }
+    }
+
+    radius = half;
+  }
+
+  free(centers);
+}
+
+// Returns the index of the scanned test angle with the highest peak.
+static size_t best_scanned_angle(const RotationScan *scan, size_t line) {
+  const int *peaks = &scan->peaks[line * scan->angles_count];
+  int max_peak = 0;
+  size_t best = 0;
+
+  for (size_t angle = 0; angle < scan->angles_count; angle++) {
+    if (peaks[angle] > max_peak) {
+      best = angle;
+      max_peak = peaks[angle];
     }
   }
-  return detected_rotation;
+  return best;
 }
+
 /**
- * detect rotation of a whole area.
- * angles between -deskew_scan_range and +deskew_scan_range are scanned, at
- * either the horizontal or vertical edges of the area specified by left, top,
- * right, bottom.
+ * Fits a parabola through the peak of a test angle and the peaks of its
+ * neighbours, and returns the angle at the top of the parabola.
  */
-float detect_rotation(Image image, const Rectangle mask,
-                      const DeskewParameters params) {
-  float rotation[4];
-  int count = 0;
-  float total;
-  float average;
-  float deviation;
-
-  if (params.scan_edges.left) {
-    // left
-    rotation[count] =
-        detect_edge_rotation(image, mask, params, DELTA_RIGHTWARD);
-    verboseLog(VERBOSE_NORMAL, "detected rotation left: [%d,%d,%d,%d]: %f\n",
-               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-               mask.vertex[1].y, rotation[count]);
-    count++;
+static float interpolate_peak_angle(const RotationScan *scan, size_t line,
+                                    size_t angle) {
+  const int32_t step = step_of_angle(angle);
+  const int peak = peak_at(scan, line, step);
+  const int lower = peak_at(scan, line, step - 1);
+  const int higher = peak_at(scan, line, step + 1);
+  const int curvature = lower - 2 * peak + higher;
+
+  if (peak <= 0 || lower < 0 || higher < 0 || curvature >= 0) {
+    return scan->angles[angle];
   }
-  if (params.scan_edges.top) {
-    // top
-    rotation[count] =
-        -detect_edge_rotation(image, mask, params, DELTA_DOWNWARD);
-    verboseLog(VERBOSE_NORMAL, "detected rotation top: [%d,%d,%d,%d]: %f\n",
-               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-               mask.vertex[1].y, rotation[count]);
-    count++;
+  return scan->angles[angle] + 0.5f * (lower - higher) / curvature *
+                                   scan->params.deskewScanStepRad;
+}
+
+/**
+ * The projection engine binarizes and downsamples each mask into a small
+ * bitmap, then shears the rows of the bitmap by each test angle, and projects
+ * the dark cells onto the vertical axis. When the shear matches the skew, the
+ * lines of text fall into few bins of the profile and the gaps between them
+ * into empty ones, which makes the profile's sum of squares (its variance,
+ * since the total is the same at all angles) the highest.
+ */
+
+// Largest dimension of the bitmaps scored by the projection engine.
+#define PROJECTION_BITMAP_SIZE 1024
+
+typedef struct {
+  int32_t width;
+  int32_t height;
+  size_t stride;
+  uint8_t *bits; // rows packed as in bilevel images, set bits being dark
+} ProjectionBitmap;
+
+// Each cell of the bitmap is dark if any of the pixels it covers is.
+static ProjectionBitmap create_projection_bitmap(Image image, Rectangle mask) {
+  const Rectangle area = normalize_rectangle(mask);
+  const RectangleSize size = size_of_rectangle(area);
+  const int32_t scale =
+      (max(size.width, size.height) + PROJECTION_BITMAP_SIZE - 1) /
+      PROJECTION_BITMAP_SIZE;
+  ProjectionBitmap bitmap = {
+      .width = (size.width + scale - 1) / scale,
+      .height = (size.height + scale - 1) / scale,
+  };
+  bitmap.stride = (bitmap.width + 7) / 8;
+  bitmap.bits = calloc(bitmap.stride * bitmap.height, 1);
+  uint8_t *values = malloc(size.width);
+  if (bitmap.bits == NULL || values == NULL) {
+    errOutput("unable to allocate deskew projection bitmap.");
   }
-  if (params.scan_edges.right) {
-    // right
-    rotation[count] = detect_edge_rotation(image, mask, params, DELTA_LEFTWARD);
-    verboseLog(VERBOSE_NORMAL, "detected rotation right: [%d,%d,%d,%d]: %f\n",
-               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-               mask.vertex[1].y, rotation[count]);
-    count++;
+
+  for (int32_t y = 0; y < size.height; y++) {
+    uint8_t *row = bitmap.bits + (size_t)(y / scale) * bitmap.stride;
+
+    get_grayscale_span(image, (Point){area.vertex[0].x, area.vertex[0].y + y},
+                       size.width, values);
+    for (int32_t x = 0; x < size.width; x++) {
+      if (values[x] < image.abs_black_threshold) {
+        const int32_t cell = x / scale;
+        row[cell / 8] |= 0x80 >> (cell % 8);
+      }
+    }
+  }
+  free(values);
+
+  return bitmap;
+}
+
+typedef struct {
+  ProjectionBitmap *bitmaps;
+  float *angles;
+  size_t angles_count;
+  uint64_t *scores;
+} ProjectionScan;
+
+static void score_projection(void *arg, size_t index) {
+  ProjectionScan *scan = arg;
+  const ProjectionBitmap *bitmap = &scan->bitmaps[index / scan->angles_count];
+  const float m = tanf(scan->angles[index % scan->angles_count]);
+  const int32_t middle = bitmap->width / 2;
+
+  // Rows are sheared around the middle column, by whole cells, so that runs of
+  // columns move to the same bin and can be counted a byte at a time.
+  const int32_t reach = (int32_t)(fabsf(m) * (middle + 1)) + 1;
+  const int32_t bins_count = bitmap->height + 2 * reach;
+  uint64_t *bins = calloc(bins_count, sizeof(uint64_t));
+  if (bins == NULL) {
+    errOutput("unable to allocate deskew projection profile.");
+  }
+
+  for (int32_t x = 0; x < bitmap->width;) {
+    const int32_t shift = (int32_t)floorf((x - middle) * m + 0.5f);
+    int32_t end = x + 1;
+    while (end < bitmap->width &&
+           (int32_t)floorf((end - middle) * m + 0.5f) == shift) {
+      end++;
+    }
+
+    for (int32_t y = 0; y < bitmap->height; y++) {
+      bins[reach + y - shift] +=
+          count_bits(bitmap->bits + (size_t)y * bitmap->stride, x, end - x);
+    }
+    x = end;
+  }
+
+  uint64_t score = 0;
+  for (int32_t i = 0; i < bins_count; i++) {
+    score += bins[i] * bins[i];
   }
-  if (params.scan_edges.bottom) {
-    // bottom
-    rotation[count] = -detect_edge_rotation(image, mask, params, DELTA_UPWARD);
-    verboseLog(VERBOSE_NORMAL, "detected rotation bottom: [%d,%d,%d,%d]: %f\n",
+  scan->scores[index] = score;
+  free(bins);
+}
+
+static void detect_projection_rotations(Image image, const Rectangle masks[],
+                                        size_t count,
+                                        const DeskewParameters params,
+                                        float rotations[]) {
+  ProjectionScan scan = {
+      .bitmaps = malloc(max(count, (size_t)1) * sizeof(ProjectionBitmap)),
+  };
+  scan.angles = rotation_test_angles(params, &scan.angles_count);
+  scan.scores =
+      malloc(max(count * scan.angles_count, (size_t)1) * sizeof(uint64_t));
+  if (scan.bitmaps == NULL || scan.scores == NULL) {
+    errOutput("unable to allocate deskew projections.");
+  }
+  for (size_t i = 0; i < count; i++) {
+    scan.bitmaps[i] = create_projection_bitmap(image, masks[i]);
+  }
+
+  parallel_for(count * scan.angles_count, score_projection, &scan);
+
+  for (size_t i = 0; i < count; i++) {
+    const Rectangle mask = masks[i];
+    const uint64_t *scores = &scan.scores[i * scan.angles_count];
+    size_t best = 0;
+
+    for (size_t angle = 1; angle < scan.angles_count; angle++) {
+      if (scores[angle] > scores[best]) {
+        best = angle;
+      }
+    }
+
+    rotations[i] = scan.angles[best];
+    if (params.deskewScanSubstep) {
+      const size_t lower = angle_of_step(step_of_angle(best) - 1);
+      const size_t higher = angle_of_step(step_of_angle(best) + 1);
+      if (lower < scan.angles_count && higher < scan.angles_count) {
+        const double curvature = (double)scores[lower] -
+                                 2.0 * scores[best] + (double)scores[higher];
+        if (curvature < 0) {
+          rotations[i] += 0.5 * ((double)scores[lower] - scores[higher]) /
+                          curvature * params.deskewScanStepRad;
+        }
+      }
+    }
+
+    verboseLog(VERBOSE_NORMAL,
+               "detected rotation projection: [%d,%d,%d,%d]: %f\n",
                mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-               mask.vertex[1].y, rotation[count]);
-    count++;
+               mask.vertex[1].y, rotations[i]);
+    free(scan.bitmaps[i].bits);
+  }
+
+  free(scan.scores);
+  free(scan.angles);
+  free(scan.bitmaps);
+}
+
+/**
+ * Detects the rotation of the masks of an image, storing it in rotations.
+ * Angles between -deskew_scan_range and +deskew_scan_range are scanned, at
+ * either the horizontal or vertical edges of each mask.
+ *
+ * The masks are scanned concurrently, so they must not be modified in between
+ * detections: to deskew overlapping masks one after the other, detect their
+ * rotation one at a time.
+ */
+void detect_rotations(Image image, const Rectangle masks[], size_t count,
+                      const DeskewParameters params, float rotations[]) {
+  if (params.method == DESKEW_METHOD_PROJECTION) {
+    detect_projection_rotations(image, masks, count, params, rotations);
+    return;
+  }
+
+  RotationScan scan = {
+      .masks = masks,
+      .planes = malloc(max(count, (size_t)1) * sizeof(DarknessPlane)),
+      .params = params,
+  };
+  if (scan.planes == NULL) {
+    errOutput("unable to allocate deskew darkness planes.");
+  }
+  for (size_t i = 0; i < count; i++) {
+    scan.planes[i] = create_darkness_plane(image, masks[i]);
   }
 
-  total = 0.0;
-  for (int i = 0; i < count; i++) {
-    total += rotation[i];
-  }
-  average = total / count;
-  total = 0.0;
-  for (int i = 0; i < count; i++) {
-    total += powf(rotation[i] - average, 2);
-  }
-  deviation = sqrtf(total);
-  verboseLog(VERBOSE_NORMAL,
-             "rotation average: %f  deviation: %f  rotation-scan-deviation "
-             "(maximum): %f  [%d,%d,%d,%d]\n",
-             average, deviation, params.deskewScanDeviationRad,
-             mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-             mask.vertex[1].y);
-  if (deviation <= params.deskewScanDeviationRad) {
-    return average;
+  for (size_t edge = 0; edge < 4; edge++) {
+    if (edge_enabled(params.scan_edges, edge)) {
+      scan.edges[scan.edges_count++] = edge;
+    }
+  }
+  scan.angles = rotation_test_angles(params, &scan.angles_count);
+  scan.lines_count = count * scan.edges_count;
+
+  const size_t peaks_count = scan.lines_count * scan.angles_count;
+  scan.peaks = malloc(max(peaks_count, (size_t)1) * sizeof(int));
+  scan.jobs = malloc(max(peaks_count, (size_t)1) * sizeof(size_t));
+  if (scan.peaks == NULL || scan.jobs == NULL) {
+    errOutput("unable to allocate deskew peaks.");
+  }
+  for (size_t i = 0; i < peaks_count; i++) {
+    scan.peaks[i] = PEAK_NOT_SCANNED;
+  }
+
+  const int32_t coarse_stride = (int32_t)lroundf(
+      params.deskewScanCoarseStepRad / params.deskewScanStepRad);
+  if (coarse_stride > 1) {
+    scan_coarse_to_fine(&scan, coarse_stride);
   } else {
-    verboseLog(VERBOSE_NONE, "out of deviation range - NO ROTATING\n");
-    return 0.0;
+    for (size_t line = 0; line < scan.lines_count; line++) {
+      for (size_t angle = 0; angle < scan.angles_count; angle++) {
+        queue_peak(&scan, line, step_of_angle(angle));
+      }
+    }
+    scan_queued_peaks(&scan);
   }
+
+  if (params.deskewScanSubstep) {
+    for (size_t line = 0; line < scan.lines_count; line++) {
+      const int32_t step = step_of_angle(best_scanned_angle(&scan, line));
+      queue_peak(&scan, line, step - 1);
+      queue_peak(&scan, line, step + 1);
+    }
+    scan_queued_peaks(&scan);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const Rectangle mask = masks[i];
+    float rotation[4];
+    float total;
+    float average;
+    float deviation;
+
+    for (size_t edge = 0; edge < scan.edges_count; edge++) {
+      const size_t line = i * scan.edges_count + edge;
+      const size_t angle = best_scanned_angle(&scan, line);
+      const float detected_rotation =
+          params.deskewScanSubstep ? interpolate_peak_angle(&scan, line, angle)
+                                   : scan.angles[angle];
+
+      const size_t scanned = scan.edges[edge];
+      rotation[edge] = scan_edges[scanned].negate ? -detected_rotation
+                                                  : detected_rotation;
+      verboseLog(VERBOSE_NORMAL, "detected rotation %s: [%d,%d,%d,%d]: %f\n",
+                 scan_edges[scanned].name, mask.vertex[0].x, mask.vertex[0].y,
+                 mask.vertex[1].x, mask.vertex[1].y, rotation[edge]);
+    }
+
+    total = 0.0;
+    for (size_t edge = 0; edge < scan.edges_count; edge++) {
+      total += rotation[edge];
+    }
+    average = total / (int)scan.edges_count;
+    total = 0.0;
+    for (size_t edge = 0; edge < scan.edges_count; edge++) {
+      total += powf(rotation[edge] - average, 2);
+    }
+    deviation = sqrtf(total);
+    verboseLog(VERBOSE_NORMAL,
+               "rotation average: %f  deviation: %f  rotation-scan-deviation "
+               "(maximum): %f  [%d,%d,%d,%d]\n",
+               average, deviation, params.deskewScanDeviationRad,
+               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
+               mask.vertex[1].y);
+    if (deviation <= params.deskewScanDeviationRad) {
+      rotations[i] = average;
+    } else {
+      verboseLog(VERBOSE_NONE, "out of deviation range - NO ROTATING\n");
+      rotations[i] = 0.0;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    free(scan.planes[i].darkness);
+  }
+  free(scan.planes);
+  free(scan.jobs);
+  free(scan.peaks);
+  free(scan.angles);
+}
+
+/**
+ * Copies of the rows of an image around the rows being deskewed, so that the
+ * image can be overwritten from the top down while the rows that are still to
+ * be read are kept.
+ *
+ * Every row is stored twice, count rows apart, so that the last count rows
+ * loaded are always consecutive in memory, and can be read through view as an
+ * image of their own.
+ */
+typedef struct {
+  Image image;
+  Image rows;
+  Image view;
+  int32_t count;
+  int32_t first;
+  int32_t next;
+} RowRing;
+
+static RowRing create_row_ring(Image image, int32_t first, int32_t count) {
+  RowRing ring = {
+      .image = image,
+      .rows = create_compatible_image(
+          image, (RectangleSize){image.frame->width, 2 * count}, false),
+      .view = image,
+      .count = count,
+      .first = max(first, 0),
+      .next = max(first, 0),
+  };
+
+  ring.view.frame = av_frame_alloc();
+  if (ring.view.frame == NULL) {
+    errOutput("unable to allocate deskew row ring.");
+  }
+  ring.view.frame->width = image.frame->width;
+  ring.view.frame->format = image.frame->format;
+  ring.view.frame->linesize[0] = ring.rows.frame->linesize[0];
+
+  return ring;
+}
+
+static void free_row_ring(RowRing *ring) {
+  free_image(&ring->view);
+  free_image(&ring->rows);
 }
 
 /**
- * Rotates a whole image buffer by the specified radians, around its
- * middle-point. (To rotate parts of an image, extract the part with copyBuffer,
- * rotate, and re-paste with copyBuffer.)
+ * Loads the rows of the image up to last into the ring, and points the view
+ * at the rows from first to last that are within the image, as far as the
+ * ring still holds them. Returns the row of the image at the top of the view.
  */
-static void rotate(Image source, Rectangle source_area, Image target,
-                   const float radians, Interpolation interpolate_type) {
-  Rectangle target_area = full_image(target);
-  FloatPoint source_center = center_of_rectangle(source_area);
-  FloatPoint target_center = center_of_rectangle(target_area);
+static int32_t row_ring_window(RowRing *ring, int32_t first, int32_t last) {
+  const int32_t end = min(last + 1, ring->image.frame->height);
+
+  for (; ring->next < end; ring->next++) {
+    const Rectangle row = {{{0, ring->next},
+                            {ring->image.frame->width - 1, ring->next}}};
+    const int32_t slot = ring->next % ring->count;
+
+    copy_rectangle(ring->image, ring->rows, row, (Point){0, slot});
+    copy_rectangle(ring->image, ring->rows, row,
+                   (Point){0, slot + ring->count});
+  }
+
+  const int32_t top =
+      max(max(first, ring->first), max(ring->next - ring->count, 0));
+  ring->view.frame->data[0] = ring->rows.frame->data[0] +
+                              (ptrdiff_t)(top % ring->count) *
+                                  ring->rows.frame->linesize[0];
+  ring->view.frame->height = max(ring->next - top, 0);
+
+  return top;
+}
+
+/**
+ * Rotates the mask of an image by the specified radians around its center, in
+ * place. Each rotated row is written straight back into the image: rotating
+ * by the small angles of deskewing only reads a band of rows around it, which
+ * is kept aside in a RowRing until all the rows reading it are written.
+ *
+ * The source coordinates are computed in fixed point: each span of target
+ * pixels maps to a line of the source, whose start is computed exactly and
+ * which is then stepped through by adding the rotation matrix coefficients.
+ */
+static void rotate(Image image, Rectangle mask, const float radians,
+                   Interpolation interpolate_type) {
+  const Rectangle area = clip_rectangle(image, mask);
+  if (area.vertex[0].x > area.vertex[1].x ||
+      area.vertex[0].y > area.vertex[1].y) {
+    return;
+  }
+
+  const RectangleSize size = size_of_rectangle(mask);
+  const FloatPoint source_center = center_of_rectangle(mask);
+  const FloatPoint target_center =
+      center_of_rectangle(rectangle_from_size(POINT_ORIGIN, size));
 
   // create 2D rotation matrix
-  const float sinval = sinf(radians);
-  const float cosval = cosf(radians);
-
-  scan_rectangle(target_area) {
-    const float srcX = source_center.x + (x - target_center.x) * cosval +
-                       (y - target_center.y) * sinval;
-    const float srcY = source_center.y + (y - target_center.y) * cosval -
-                       (x - target_center.x) * sinval;
-    const Pixel pxl =
-        interpolate(source, (FloatPoint){srcX, srcY}, interpolate_type);
-    set_pixel(target, (Point){x, y}, pxl);
+  const int64_t sinval = fixed_from_float(sinf(radians));
+  const int64_t cosval = fixed_from_float(cosf(radians));
+
+  // The centers may fall between pixels, so distances to them are counted in
+  // half pixels.
+  const int64_t source_x = fixed_from_float(source_center.x);
+  const int64_t source_y = fixed_from_float(source_center.y);
+  const int32_t target_x2 = (int32_t)lroundf(target_center.x * 2);
+  const int32_t target_y2 = (int32_t)lroundf(target_center.y * 2);
+
+  // Rows of the source read for a row of the target, either way of it,
+  // including the pixels around each point that interpolation reads.
+  const int32_t reach =
+      (int32_t)ceilf(fabsf(sinf(radians)) * (size.width / 2.0f + 1) +
+                     (1.0f - cosf(radians)) * (size.height / 2.0f + 1)) +
+      3;
+  RowRing ring =
+      create_row_ring(image, area.vertex[0].y - reach, 2 * reach + 1);
+
+  const PixelRowWriter write_pixels = get_pixel_row_writer(image);
+  Pixel pixels[ROTATION_SPAN_SIZE];
+
+  scan_rectangle_spans(area, ROTATION_SPAN_SIZE) {
+    const int32_t top = row_ring_window(&ring, y - reach, y + reach);
+    const int64_t dx2 = 2 * (x - mask.vertex[0].x) - target_x2;
+    const int64_t dy2 = 2 * (y - mask.vertex[0].y) - target_y2;
+    const FixedPoint start = {
+        source_x + ((dx2 * cosval + dy2 * sinval) >> 1),
+        source_y - (int64_t)top * FIXED_POINT_ONE +
+            ((dy2 * cosval - dx2 * sinval) >> 1),
+    };
+
+    interpolate_line(ring.view, start, (FixedPoint){cosval, -sinval}, length,
+                     interpolate_type, pixels);
+    write_pixels(get_writable_pixel_row(image, y), x, length, pixels,
+                 image.abs_black_threshold);
   }
+
+  free_row_ring(&ring);
 }
 
-void deskew(Image source, Rectangle mask, float radians,
-            Interpolation interpolate_type) {
-  Image rotated =
-      create_compatible_image(source, size_of_rectangle(mask), true);
+/**
+ * Copies an area of source to target_coords in target, filling the pixels that
+ * fall outside of source with white, as interpolate() reads them.
+ */
+static void copy_shifted(Image source, Rectangle source_area, Image target,
+                         Point target_coords) {
+  wipe_rectangle(
+      target,
+      rectangle_from_size(target_coords, size_of_rectangle(source_area)),
+      PIXEL_WHITE);
+
+  const Rectangle visible = clip_rectangle(source, source_area);
+  if (visible.vertex[0].x > visible.vertex[1].x ||
+      visible.vertex[0].y > visible.vertex[1].y) {
+    return;
+  }
+  copy_rectangle(source, target, visible,
+                 shift_point(target_coords, distance_between(
+                                                source_area.vertex[0],
+                                                visible.vertex[0])));
+}
+
+/**
+ * Shears the rows of source horizontally into an area of target:
+ *
+ *   target(x, y) = source(origin.x + x + slope * (y - center), origin.y + y)
+ *
+ * with x and y counted from the corner of the area, slope in fixed point, and
+ * center in half pixels. Only the part of the area within target is written.
+ */
+static void shear_rows(Image source, Point origin, Image target,
+                       Rectangle target_area, int64_t slope, int32_t center2,
+                       Interpolation interpolate_type) {
+  const Rectangle area = clip_rectangle(target, target_area);
+  const Point corner = target_area.vertex[0];
+  const PixelRowWriter write_pixels = get_pixel_row_writer(target);
+  Pixel taps[SHEAR_SPAN_SIZE + 3];
+  Pixel pixels[SHEAR_SPAN_SIZE];
+
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+    const int32_t source_y = origin.y + y - corner.y;
+    const int64_t shift = (slope * (2 * (y - corner.y) - center2)) >> 1;
+    const int32_t whole = fixed_floor(shift);
+    const int64_t fraction = shift - whole * FIXED_POINT_ONE;
 
-  // rotate
-  rotate(source, mask, rotated, -radians, interpolate_type);
+    // Without interpolation, rows are only moved, which bilevel images do
+    // by shifting bits.
+    if (interpolate_type == INTERP_NN) {
+      const int32_t moved = whole + (fraction >= FIXED_POINT_HALF);
+      copy_shifted(source,
+                   rectangle_from_size(
+                       (Point){origin.x + area.vertex[0].x - corner.x + moved,
+                               source_y},
+                       (RectangleSize){size_of_rectangle(area).width, 1}),
+                   target, (Point){area.vertex[0].x, y});
+      continue;
+    }
+
+    const TapWeights weights = tap_weights(fraction, interpolate_type);
+    for (int32_t x = area.vertex[0].x; x <= area.vertex[1].x;
+         x += SHEAR_SPAN_SIZE) {
+      const int32_t length = span_length(x, area.vertex[1].x, SHEAR_SPAN_SIZE);
 
-  // copy result back into whole image
-  copy_rectangle(rotated, source, full_image(rotated), mask.vertex[0]);
+      get_pixel_span(source,
+                     (Point){origin.x + x - corner.x + whole - 1, source_y},
+                     length + 3, taps);
+      interpolate_span(taps, weights, length, pixels);
+      write_pixels(get_writable_pixel_row(target, y), x, length, pixels,
+                   target.abs_black_threshold);
+    }
+  }
+}
 
-  free_image(&rotated);
+/**
+ * Shears the columns of source vertically into target:
+ *
+ *   target(x, y) = source(origin.x + x, origin.y + y + slope * (x - center))
+ *
+ * with slope in fixed point, and center in half pixels. The columns are read
+ * and written a row at a time, in runs of columns moved by the same number of
+ * whole pixels.
+ */
+static void shear_columns(Image source, Point origin, Image target,
+                          int64_t slope, int32_t center2,
+                          Interpolation interpolate_type) {
+  const RectangleSize size = size_of_image(target);
+  const PixelRowWriter write_pixels = get_pixel_row_writer(target);
+  int32_t *wholes = malloc(size.width * sizeof(int32_t));
+  TapWeights *weights = malloc(size.width * sizeof(TapWeights));
+  if (wholes == NULL || weights == NULL) {
+    errOutput("unable to allocate shear offsets.");
+  }
+
+  for (int32_t x = 0; x < size.width; x++) {
+    const int64_t shift = (slope * (2 * x - center2)) >> 1;
+    const int64_t fraction = shift - fixed_floor(shift) * FIXED_POINT_ONE;
+
+    wholes[x] = fixed_floor(shift);
+    weights[x] = tap_weights(fraction, interpolate_type);
+    if (interpolate_type == INTERP_NN) {
+      wholes[x] += fraction >= FIXED_POINT_HALF;
+    }
+  }
+
+  if (interpolate_type == INTERP_NN) {
+    for (int32_t x = 0, end; x < size.width; x = end) {
+      for (end = x + 1; end < size.width && wholes[end] == wholes[x]; end++) {
+      }
+      copy_shifted(source,
+                   rectangle_from_size(
+                       (Point){origin.x + x, origin.y + wholes[x]},
+                       (RectangleSize){end - x, size.height}),
+                   target, (Point){x, 0});
+    }
+  } else {
+    Pixel rows[4][SHEAR_SPAN_SIZE];
+    const Pixel *const taps[4] = {rows[0], rows[1], rows[2], rows[3]};
+    Pixel pixels[SHEAR_SPAN_SIZE];
+
+    for (int32_t y = 0; y < size.height; y++) {
+      for (int32_t x = 0, end; x < size.width; x = end) {
+        for (end = x + 1; end < size.width && end - x < SHEAR_SPAN_SIZE &&
+                          wholes[end] == wholes[x];
+             end++) {
+        }
+
+        for (int i = 0; i < 4; i++) {
+          const int32_t row = origin.y + y + wholes[x] + i - 1;
+          get_pixel_span(source, (Point){origin.x + x, row}, end - x, rows[i]);
+        }
+        interpolate_across(taps, &weights[x], end - x, pixels);
+        write_pixels(get_writable_pixel_row(target, y), x, end - x, pixels,
+                     target.abs_black_threshold);
+      }
+    }
+  }
+
+  free(weights);
+  free(wholes);
+}
+
+/**
+ * Rotates the mask of an image in place like rotate(), as a sequence of three
+ * shears (A. Paeth, "A Fast Algorithm for General Raster Rotation"): the
+ * rotation matrix is the product of a horizontal shear by tan(radians / 2), a
+ * vertical one by -sin(radians), and the first one again. Each shear only
+ * needs 1-D interpolation, along rows or columns, but the image is resampled
+ * three times, and the intermediate images grow with the angle.
+ */
+static void shear_rotate(Image image, Rectangle mask, const float radians,
+                         Interpolation interpolate_type) {
+  const RectangleSize size = size_of_rectangle(mask);
+  const Point source_origin = mask.vertex[0];
+  const FloatPoint target_center =
+      center_of_rectangle(rectangle_from_size(POINT_ORIGIN, size));
+  const int32_t target_x2 = (int32_t)lroundf(target_center.x * 2);
+  const int32_t target_y2 = (int32_t)lroundf(target_center.y * 2);
+
+  const float alpha = tanf(radians / 2);
+  const float beta = -sinf(radians);
+
+  // The intermediate images have margins for the pixels that the shears move
+  // in from outside of the mask. The last shear reads them only, so it writes
+  // into the mask directly.
+  const int32_t margin_x =
+      (int32_t)ceilf(fabsf(alpha) * (size.height / 2 + 1)) + 2;
+  const int32_t width = size.width + 2 * margin_x;
+  const int32_t margin_y = (int32_t)ceilf(fabsf(beta) * (width / 2 + 1)) + 2;
+
+  Image sheared_rows = create_compatible_image(
+      image, (RectangleSize){width, size.height + 2 * margin_y}, false);
+  Image sheared_columns = create_compatible_image(
+      image, (RectangleSize){width, size.height}, false);
+
+  shear_rows(image,
+             (Point){source_origin.x - margin_x, source_origin.y - margin_y},
+             sheared_rows, full_image(sheared_rows), fixed_from_float(alpha),
+             target_y2 + 2 * margin_y, interpolate_type);
+  shear_columns(sheared_rows, (Point){0, margin_y}, sheared_columns,
+                fixed_from_float(beta), target_x2 + 2 * margin_x,
+                interpolate_type);
+  shear_rows(sheared_columns, (Point){margin_x, 0}, image, mask,
+             fixed_from_float(alpha), target_y2, interpolate_type);
+
+  free_image(&sheared_columns);
+  free_image(&sheared_rows);
+}
+
+void deskew(Image source, Rectangle mask, float radians,
+            Interpolation interpolate_type, const DeskewParameters params) {
+  mask = normalize_rectangle(mask);
+
+  // rotate in place, by shearing if the angle is small enough
+  if (fabsf(radians) < params.deskewShearLimitRad) {
+    shear_rotate(source, mask, -radians, interpolate_type);
+  } else {
+    rotate(source, mask, -radians, interpolate_type);
+  }
 }
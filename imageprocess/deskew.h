@@ -4,28 +4,43 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "imageprocess/image.h"
 #include "imageprocess/interpolate.h"
 #include "imageprocess/primitives.h"
 
+typedef enum {
+  DESKEW_METHOD_EDGE,
+  DESKEW_METHOD_PROJECTION,
+} DeskewMethod;
+
 typedef struct {
+  DeskewMethod method;
   float deskewScanRangeRad;
   float deskewScanStepRad;
+  float deskewScanCoarseStepRad; // 0 to scan every step
+  bool deskewScanSubstep;
   float deskewScanDeviationRad;
   int deskewScanSize;
   float deskewScanDepth;
   Edges scan_edges;
+  float deskewShearLimitRad; // 0 to never rotate by shearing
 } DeskewParameters;
 
-bool validate_deskew_parameters(DeskewParameters *params, float deskewScanRange,
-                                float deskewScanStep, float deskewScanDeviation,
-                                int deskewScanSize, float deskewScanDepth,
-                                Edges deskewScanEdges);
+bool validate_deskew_parameters(DeskewParameters *params,
+                                DeskewMethod deskewMethod,
+                                float deskewScanRange, float deskewScanStep,
+                                float deskewScanCoarseStep,
+                                bool deskewScanSubstep,
+                                float deskewScanDeviation, int deskewScanSize,
+                                float deskewScanDepth, Edges deskewScanEdges,
+                                float deskewShearLimit);
 
-float detect_rotation(Image image, Rectangle mask,
-                      const DeskewParameters params);
+void detect_rotations(Image image, const Rectangle masks[], size_t count,
+                      const DeskewParameters params, float rotations[]);
 
 void deskew(Image source, Rectangle mask, float radians,
-            Interpolation interpolate_type);
+            Interpolation interpolate_type, const DeskewParameters params);
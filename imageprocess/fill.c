@@ -2,8 +2,14 @@
 //
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
 #include "imageprocess/fill.h"
 #include "imageprocess/pixel.h"
+#include "lib/logging.h"
 
 /**
  * Solidly fills a line of pixels heading towards a specified direction
@@ -42,66 +48,116 @@ static uint64_t fill_line(Image image, Point p, Delta step, Pixel color,
   }
 }
 
+// Initial number of frames of the flood-fill work stack.
+#define FILL_STACK_SIZE 64
+
+/**
+ * A cross filled by the flood-fill, and the progress through the pixels
+ * around its arms that still have to be visited.
+ */
+typedef struct {
+  Point center;
+  uint32_t arm_length[4];
+  // Arm currently visited, and index of the next neighbour along it: each
+  // pixel of the arm has two, one on each side.
+  uint32_t arm;
+  uint32_t next;
+} FillFrame;
+
+// Directions of the arms of a cross: leftward, upward, rightward, downward.
+static const Delta arm_steps[4] = {{-1, 0}, {0, -1}, {1, 0}, {0, 1}};
+
 /**
- * Start flood-filling around the edges of a line which has previously been
- * filled using fillLine(). Here, the flood-fill algorithm performs its
- * indirect recursion.
+ * Fills a 'cross' (both vertical and horizontal line) centered on the given
+ * pixel, if it is to be filled.
  *
- * @param step_x either -1 or 1, if step_y is 0, else 0
- * @param step_y either -1 or 1, if step_x is 0, else 0
- * @see fillLine()
+ * @return false if the pixel is not to be filled.
  */
-static void flood_fill_around_line(Image image, Point p, Delta step,
-                                   uint64_t distance, Pixel color,
-                                   uint8_t mask_min, uint8_t mask_max,
-                                   uint64_t intensity) {
-  for (uint64_t d = 0; d < distance; d++) {
-    if (step.horizontal != 0) {
-      p.x += step.horizontal;
-      // indirect recursion
-      flood_fill(image, shift_point(p, DELTA_DOWNWARD), color, mask_min,
-                 mask_max, intensity);
-      flood_fill(image, shift_point(p, DELTA_UPWARD), color, mask_min, mask_max,
-                 intensity);
-    } else { // step.vertical != 0
-      p.y += step.vertical;
-      flood_fill(image, shift_point(p, DELTA_RIGHTWARD), color, mask_min,
-                 mask_max, intensity);
-      flood_fill(image, shift_point(p, DELTA_LEFTWARD), color, mask_min,
-                 mask_max, intensity);
-    }
+static bool fill_cross(Image image, Point p, Pixel color, uint8_t mask_min,
+                       uint8_t mask_max, uint64_t intensity,
+                       FillFrame *frame) {
+  uint8_t pixel = get_pixel_grayscale(image, p);
+  if ((pixel < mask_min) || (pixel > mask_max)) {
+    return false;
+  }
+
+  set_pixel(image, p, color);
+  *frame = (FillFrame){.center = p};
+  for (uint32_t arm = 0; arm < 4; arm++) {
+    frame->arm_length[arm] = fill_line(image, p, arm_steps[arm], color,
+                                       mask_min, mask_max, intensity);
   }
+  return true;
 }
 
 /**
- * Flood-fill an area of pixels. (Naive implementation, optimizable.)
+ * Flood-fill an area of pixels.
  *
- * @see earlier header-declaration to enable indirect recursive calls
+ * Starting from a cross filled around the first pixel, a new cross is filled
+ * around each of the pixels that border the arms of a filled cross, depth
+ * first. Since the lines filled with fill_line() can bridge gaps of
+ * non-matching pixels, the filled area depends on the order in which the
+ * crosses are filled, which is kept the same as the original recursive
+ * implementation; the pending crosses are however kept on a heap-allocated
+ * stack, so that large areas cannot overflow the call stack.
  */
 void flood_fill(Image image, Point p, Pixel color, uint8_t mask_min,
                 uint8_t mask_max, uint64_t intensity) {
-  // is current pixel to be filled?
-  uint8_t pixel = get_pixel_grayscale(image, p);
-  if ((pixel >= mask_min) && (pixel <= mask_max)) {
-    // first, fill a 'cross' (both vertical, horizontal line)
-    set_pixel(image, p, color);
-    const uint64_t left = fill_line(image, p, DELTA_LEFTWARD, color, mask_min,
-                                    mask_max, intensity);
-    const uint64_t top =
-        fill_line(image, p, DELTA_UPWARD, color, mask_min, mask_max, intensity);
-    const uint64_t right = fill_line(image, p, DELTA_RIGHTWARD, color, mask_min,
-                                     mask_max, intensity);
-    const uint64_t bottom = fill_line(image, p, DELTA_DOWNWARD, color, mask_min,
-                                      mask_max, intensity);
-    // now recurse on each neighborhood-pixel of the cross (most recursions will
-    // immediately return)
-    flood_fill_around_line(image, p, DELTA_LEFTWARD, left, color, mask_min,
-                           mask_max, intensity);
-    flood_fill_around_line(image, p, DELTA_UPWARD, top, color, mask_min,
-                           mask_max, intensity);
-    flood_fill_around_line(image, p, DELTA_RIGHTWARD, right, color, mask_min,
-                           mask_max, intensity);
-    flood_fill_around_line(image, p, DELTA_DOWNWARD, bottom, color, mask_min,
-                           mask_max, intensity);
+  FillFrame first;
+  if (!fill_cross(image, p, color, mask_min, mask_max, intensity, &first)) {
+    return;
   }
+
+  size_t allocated = FILL_STACK_SIZE, depth = 0;
+  FillFrame *stack = malloc(allocated * sizeof(FillFrame));
+  if (stack == NULL) {
+    errOutput("unable to allocate flood-fill stack.");
+  }
+  stack[depth++] = first;
+
+  while (depth > 0) {
+    FillFrame *frame = &stack[depth - 1];
+
+    while (frame->arm < 4 &&
+           frame->next >= 2 * frame->arm_length[frame->arm]) {
+      frame->arm++;
+      frame->next = 0;
+    }
+    if (frame->arm == 4) {
+      depth--;
+      continue;
+    }
+
+    // Neighbours of a horizontal arm are below then above it, those of a
+    // vertical arm are right then left of it.
+    const Delta step = arm_steps[frame->arm];
+    const int32_t distance = frame->next / 2 + 1;
+    const bool first_side = frame->next % 2 == 0;
+    Point neighbour = shift_point(
+        frame->center,
+        (Delta){step.horizontal * distance, step.vertical * distance});
+    if (step.horizontal != 0) {
+      neighbour.y += first_side ? 1 : -1;
+    } else {
+      neighbour.x += first_side ? 1 : -1;
+    }
+    frame->next++;
+
+    FillFrame next;
+    if (!fill_cross(image, neighbour, color, mask_min, mask_max, intensity,
+                    &next)) {
+      continue;
+    }
+
+    if (depth == allocated) {
+      allocated *= 2;
+      stack = realloc(stack, allocated * sizeof(FillFrame));
+      if (stack == NULL) {
+        errOutput("unable to allocate flood-fill stack.");
+      }
+    }
+    stack[depth++] = next;
+  }
+
+  free(stack);
 }
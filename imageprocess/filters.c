@@ -3,15 +3,20 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "constants.h"
 #include "imageprocess/blit.h"
+#include "imageprocess/components.h"
 #include "imageprocess/fill.h"
 #include "imageprocess/filters.h"
 #include "imageprocess/pixel.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
+#include "lib/parallel.h"
 
 /***************
  * Blackfilter *
@@ -45,6 +50,98 @@ bool validate_blackfilter_parameters(BlackfilterParameters *params,
   return true;
 }
 
+// Number of pixels read at once when looking for flood-fill seeds.
+#define BLACKFILTER_SPAN_SIZE 512
+
+/**
+ * Sums of the inverse darkness over the lines of a scan stripe that cross it,
+ * that is the columns of a horizontal stripe or the rows of a vertical one,
+ * accumulated along the stripe: sums[i] is the sum over the pixels of the
+ * stripe in the first i lines of the image. The darkness of any window of the
+ * stripe then only needs two entries.
+ */
+typedef struct {
+  bool horizontal;
+  Rectangle area; // the stripe, clipped to the image.
+  uint64_t *sums;
+  uint8_t *values; // scratch row for reading the image.
+} StripeSums;
+
+static void compute_stripe_sums(Image image, StripeSums *stripe,
+                                Rectangle area) {
+  const RectangleSize image_size = size_of_image(image);
+  const int32_t lines =
+      stripe->horizontal ? image_size.width : image_size.height;
+
+  stripe->area = clip_rectangle(image, area);
+  for (int32_t i = 0; i <= lines; i++) {
+    stripe->sums[i] = 0;
+  }
+
+  if (stripe->horizontal) {
+    const int32_t width = image_size.width;
+    for (int32_t y = stripe->area.vertex[0].y; y <= stripe->area.vertex[1].y;
+         y++) {
+      get_darkness_inverse_span(image, (Point){0, y}, width, stripe->values);
+      for (int32_t x = 0; x < width; x++) {
+        stripe->sums[x + 1] += stripe->values[x];
+      }
+    }
+  } else {
+    const int32_t width =
+        stripe->area.vertex[1].x - stripe->area.vertex[0].x + 1;
+    for (int32_t y = 0; y < image_size.height; y++) {
+      get_darkness_inverse_span(image, (Point){stripe->area.vertex[0].x, y},
+                                width, stripe->values);
+      for (int32_t x = 0; x < width; x++) {
+        stripe->sums[y + 1] += stripe->values[x];
+      }
+    }
+  }
+
+  for (int32_t i = 0; i < lines; i++) {
+    stripe->sums[i + 1] += stripe->sums[i];
+  }
+}
+
+// Same as darkness_rect(), for a window along the stripe.
+static uint8_t stripe_darkness(Image image, const StripeSums *stripe,
+                               Rectangle area) {
+  const Rectangle clipped = clip_rectangle(image, area);
+  if (clipped.vertex[0].x > clipped.vertex[1].x ||
+      clipped.vertex[0].y > clipped.vertex[1].y) {
+    return darkness_rect(image, area);
+  }
+
+  const uint64_t darkness =
+      stripe->horizontal
+          ? stripe->sums[clipped.vertex[1].x + 1] -
+                stripe->sums[clipped.vertex[0].x]
+          : stripe->sums[clipped.vertex[1].y + 1] -
+                stripe->sums[clipped.vertex[0].y];
+
+  return 0xFF - (darkness / count_pixels(clipped));
+}
+
+// Starts a flood-fill from every dark pixel of the area. Fills only ever turn
+// pixels white, so the pixels that are not dark when a row is read cannot
+// become seeds later, and most of the others have been cleared by the first
+// fill already, in which case flood_fill() returns right away.
+static void blackfilter_flood_fill(Image image, Rectangle area,
+                                   uint64_t intensity) {
+  uint8_t values[BLACKFILTER_SPAN_SIZE];
+
+  scan_rectangle_spans(area, BLACKFILTER_SPAN_SIZE) {
+    get_grayscale_span(image, (Point){x, y}, length, values);
+    for (int32_t i = 0; i < length; i++) {
+      if (values[i] <= image.abs_black_threshold) {
+        flood_fill(image, (Point){x + i, y}, PIXEL_WHITE, 0,
+                   image.abs_black_threshold, intensity);
+      }
+    }
+  }
+}
+
 static void blackfilter_scan(Image image, BlackfilterParameters params,
                              Delta step, RectangleSize stripe_size,
                              Delta shift) {
@@ -55,6 +152,15 @@ static void blackfilter_scan(Image image, BlackfilterParameters params,
   }
 
   const Rectangle image_area = full_image(image);
+  const RectangleSize image_size = size_of_image(image);
+
+  StripeSums stripe = {.horizontal = step.vertical == 0};
+  stripe.sums = calloc(max(image_size.width, image_size.height) + 1,
+                       sizeof(uint64_t));
+  stripe.values = malloc(image_size.width);
+  if (stripe.sums == NULL || stripe.values == NULL) {
+    errOutput("unable to allocate blackfilter buffers.");
+  }
 
   Rectangle area = rectangle_from_size(POINT_ORIGIN, stripe_size);
   while (point_in_rectangle(area.vertex[0], image_area)) {
@@ -68,8 +174,10 @@ static void blackfilter_scan(Image image, BlackfilterParameters params,
 
     bool already_excluded_logged = false;
 
+    compute_stripe_sums(image, &stripe, area);
+
     do {
-      uint8_t blackness = darkness_rect(image, area);
+      uint8_t blackness = stripe_darkness(image, &stripe, area);
 
       // If we find a solidly black area.
       if (blackness >= params.abs_threshold) {
@@ -82,10 +190,10 @@ static void blackfilter_scan(Image image, BlackfilterParameters params,
           // start flood-fill in this area (on each pixel to make sure we get
           // everything, in most cases first flood-fill from first pixel will
           // delete all other black pixels in the area already)
-          scan_rectangle(area) {
-            flood_fill(image, (Point){x, y}, PIXEL_WHITE, 0,
-                       image.abs_black_threshold, params.intensity);
-          }
+          blackfilter_flood_fill(image, area, params.intensity);
+
+          // The fill can have cleared pixels anywhere in the stripe.
+          compute_stripe_sums(image, &stripe, area);
         } else if (!already_excluded_logged) {
           verboseLog(VERBOSE_NORMAL, "black-area EXCLUDED: [%d,%d,%d,%d]\n",
                      area.vertex[0].x, area.vertex[0].y, area.vertex[1].x,
@@ -100,6 +208,9 @@ static void blackfilter_scan(Image image, BlackfilterParameters params,
 
     area = shift_rectangle(area, shift);
   }
+
+  free(stripe.sums);
+  free(stripe.values);
 }
 
 /**
@@ -141,25 +252,128 @@ bool validate_blurfilter_parameters(BlurfilterParameters *params,
   return true;
 }
 
+// Number of image rows counted by each job of blurfilter().
+#define BLURFILTER_BAND_HEIGHT 64
+
+/**
+ * Numbers of dark pixels in the columns of blocks of the blurfilter, as sums
+ * over the rows of the image: counts[y * columns + c] is the number of dark
+ * pixels in the first y rows of column c. Column c covers the pixels from
+ * (c - 1) * block_width, so that there is an extra column on each side of the
+ * image.
+ */
+typedef struct {
+  Image image;
+  int32_t block_width;
+  int32_t columns;
+  uint8_t abs_white_threshold;
+  uint64_t *counts;
+} BlurfilterCounts;
+
+static void blurfilter_count_band(void *arg, size_t band) {
+  const BlurfilterCounts *grid = arg;
+  const RectangleSize image_size = size_of_image(grid->image);
+  const int32_t first_y = band * BLURFILTER_BAND_HEIGHT;
+  const int32_t last_y =
+      min(first_y + BLURFILTER_BAND_HEIGHT, image_size.height) - 1;
+
+  uint8_t *values = malloc(image_size.width);
+  if (values == NULL) {
+    errOutput("unable to allocate blurfilter buffer.");
+  }
+
+  for (int32_t y = first_y; y <= last_y; y++) {
+    uint64_t *row = grid->counts + ((size_t)y + 1) * grid->columns;
+
+    get_grayscale_span(grid->image, (Point){0, y}, image_size.width, values);
+    for (int32_t c = 0; c < grid->columns; c++) {
+      const int32_t first_x = max((c - 1) * grid->block_width, 0);
+      const int32_t end_x = min(c * grid->block_width, image_size.width);
+      uint64_t dark = 0;
+
+      for (int32_t x = first_x; x < end_x; x++) {
+        dark += values[x] <= grid->abs_white_threshold;
+      }
+      row[c] = dark;
+    }
+  }
+
+  free(values);
+}
+
+// Same as count_pixels_within_brightness(), from 0 to the white threshold, for
+// the block of the given column starting at the given row.
+static uint64_t blurfilter_block_count(const BlurfilterCounts *grid,
+                                       int32_t column, int32_t top,
+                                       RectangleSize block_size) {
+  const RectangleSize image_size = size_of_image(grid->image);
+  const int32_t first_y = max(min(top, image_size.height), 0);
+  const int32_t end_y = max(min(top + block_size.height, image_size.height), 0);
+
+  uint64_t dark = grid->counts[(size_t)end_y * grid->columns + column] -
+                  grid->counts[(size_t)first_y * grid->columns + column];
+
+  // Pixels outside of the image are considered white.
+  if (grid->abs_white_threshold == UINT8_MAX) {
+    const int32_t first_x = max((column - 1) * block_size.width, 0);
+    const int32_t end_x =
+        max(min(column * block_size.width, image_size.width), first_x);
+    dark += (uint64_t)block_size.width * block_size.height -
+            (uint64_t)(end_x - first_x) * (end_y - first_y);
+  }
+
+  return dark;
+}
+
 void blurfilter(Image image, BlurfilterParameters params,
                 uint8_t abs_white_threshold) {
   verboseLog(VERBOSE_NORMAL, "blur-filter...");
 
   RectangleSize image_size = size_of_image(image);
-  const uint32_t blocks_per_row = image_size.width / params.scan_size.width;
+  const int32_t blocks_per_row = image_size.width / params.scan_size.width;
   const uint64_t total_pixels_in_block =
       params.scan_size.width * params.scan_size.height;
   uint64_t count = 0;
 
+  // Count the dark pixels of all the blocks in a single pass over the image,
+  // split in bands of rows counted in parallel.
+  BlurfilterCounts grid = {
+      .image = image,
+      .block_width = params.scan_size.width,
+      .columns = blocks_per_row + 2,
+      .abs_white_threshold = abs_white_threshold,
+  };
+  grid.counts =
+      calloc(((size_t)image_size.height + 1) * grid.columns, sizeof(uint64_t));
+  if (grid.counts == NULL) {
+    errOutput("unable to allocate blurfilter counts.");
+  }
+
+  parallel_for((image_size.height + BLURFILTER_BAND_HEIGHT - 1) /
+                   BLURFILTER_BAND_HEIGHT,
+               blurfilter_count_band, &grid);
+
+  for (int32_t y = 0; y < image_size.height; y++) {
+    const uint64_t *above = grid.counts + (size_t)y * grid.columns;
+    uint64_t *row = grid.counts + ((size_t)y + 1) * grid.columns;
+
+    for (int32_t c = 0; c < grid.columns; c++) {
+      row[c] += above[c];
+    }
+  }
+
   // allocate one extra block left and right
-  uint64_t count_buffers[3][blocks_per_row + 2];
+  uint64_t *count_buffers = calloc(3 * grid.columns, sizeof(uint64_t));
+  if (count_buffers == NULL) {
+    errOutput("unable to allocate blurfilter counts.");
+  }
 
   // Number of dark pixels in previous row
-  uint64_t *prevCounts = &count_buffers[0][0];
+  uint64_t *prevCounts = &count_buffers[0];
   // Number of dark pixels in current row
-  uint64_t *curCounts = &count_buffers[0][1];
+  uint64_t *curCounts = &count_buffers[1];
   // Number of dark pixels in next row
-  uint64_t *nextCounts = &count_buffers[0][2];
+  uint64_t *nextCounts = &count_buffers[2];
 
   // Left and Right.
   curCounts[0] = total_pixels_in_block;
@@ -170,9 +384,9 @@ void blurfilter(Image image, BlurfilterParameters params,
   const int32_t max_left = image_size.width - params.scan_size.width;
   for (int32_t left = 0, block = 1; left <= max_left;
        left += params.scan_size.width) {
-    curCounts[block++] = count_pixels_within_brightness(
-        image, rectangle_from_size((Point){left, 0}, params.scan_size), 0,
-        abs_white_threshold, false);
+    curCounts[block] =
+        blurfilter_block_count(&grid, block, 0, params.scan_size);
+    block++;
   }
 
   // Loop through all blocks. For a block calculate the number of dark pixels in
@@ -180,24 +394,22 @@ void blurfilter(Image image, BlurfilterParameters params,
   // and similarly for the block in the top-right, bottom-left and bottom-right
   // corner. Take the maximum of these values. Clear the block if this number is
   // not large enough compared to the total number of pixels in a block.
+  //
+  // Clearing a block never changes the counts read afterwards, so they can all
+  // be taken from the grid computed above.
   int32_t max_top = image_size.height - params.scan_size.height;
   for (int32_t top = 0; top <= max_top; top += params.scan_size.height) {
-    nextCounts[0] = count_pixels_within_brightness(
-        image,
-        rectangle_from_size((Point){0, top + params.scan_step.vertical},
-                            params.scan_size),
-        0, abs_white_threshold, false);
+    const int32_t next_top = top + params.scan_step.vertical;
+
+    nextCounts[0] =
+        blurfilter_block_count(&grid, 1, next_top, params.scan_size);
 
     for (int32_t left = 0, block = 1; left <= max_left;
          left += params.scan_size.width) {
 
       // bottom right (has still to be calculated)
-      nextCounts[block + 1] = count_pixels_within_brightness(
-          image,
-          rectangle_from_size((Point){left + params.scan_size.width,
-                                      top + params.scan_step.vertical},
-                              params.scan_size),
-          0, abs_white_threshold, false);
+      nextCounts[block + 1] =
+          blurfilter_block_count(&grid, block + 1, next_top, params.scan_size);
 
       uint64_t max = max3(
           nextCounts[block - 1], nextCounts[block + 1],
@@ -223,6 +435,9 @@ void blurfilter(Image image, BlurfilterParameters params,
     nextCounts = tmpCounts;
   }
 
+  free(count_buffers);
+  free(grid.counts);
+
   verboseLog(VERBOSE_NORMAL, " deleted %" PRIu64 " pixels.\n", count);
 }
 
@@ -230,110 +445,39 @@ void blurfilter(Image image, BlurfilterParameters params,
  * Noisefilter *
  ***************/
 
-static bool noisefilter_compare_and_clear(Image image, Point p, bool clear,
-                                          uint8_t min_white_level) {
-  uint8_t lightness = get_pixel_lightness(image, p);
-  if (lightness >= min_white_level) {
-    return false;
-  }
-
-  if (clear) {
-    set_pixel(image, p, PIXEL_WHITE);
-  }
-  return true;
-}
-
-static uint64_t
-noisefilter_count_pixel_neighbors_level(Image image, Point p, uint32_t level,
-                                        bool clear, uint8_t min_white_level) {
-  uint64_t count = 0;
-
-  // upper and lower rows
-  for (int32_t xx = p.x - level; xx <= p.x + level; xx++) {
-    Point upper = {xx, p.y - level}, lower = {xx, p.y + level};
-
-    count += noisefilter_compare_and_clear(image, upper, clear, min_white_level)
-                 ? 1
-                 : 0;
-    count += noisefilter_compare_and_clear(image, lower, clear, min_white_level)
-                 ? 1
-                 : 0;
-  }
-
-  // middle rows
-  for (int32_t yy = p.y - (level - 1); yy <= p.y + (level - 1); yy++) {
-    Point first = {p.x - level, yy}, last = {p.x + level, yy};
-    count += noisefilter_compare_and_clear(image, first, clear, min_white_level)
-                 ? 1
-                 : 0;
-    count += noisefilter_compare_and_clear(image, last, clear, min_white_level)
-                 ? 1
-                 : 0;
-  }
-
-  return count;
-}
-
-static uint64_t noisefilter_count_pixel_neighbors(Image image, Point p,
-                                                  uint64_t intensity,
-                                                  uint8_t min_white_level) {
-  // can finish when one level is completely zero
-  uint64_t count = 1; // assume self as set
-  uint64_t lCount;
-  uint32_t level = 1;
-  do {
-    lCount = noisefilter_count_pixel_neighbors_level(image, p, level, false,
-                                                     min_white_level);
-    count += lCount;
-    level++;
-  } while (lCount != 0 && (level <= intensity));
-
-  return count;
-}
-
-static void noisefilter_clear_pixel_neighbors(Image image, Point p,
-                                              uint8_t min_white_level) {
-  set_pixel(image, p, PIXEL_WHITE);
-
-  // lCount will become 0, otherwise countPixelNeighbors() would previously have
-  // delivered a bigger value (and this here would not have been called)
-  uint64_t lCount;
-  uint32_t level = 1;
-  do {
-    lCount = noisefilter_count_pixel_neighbors_level(image, p, level, true,
-                                                     min_white_level);
-    level++;
-  } while (lCount != 0);
-}
-
 /**
- * Applies a simple noise filter to the image.
+ * Applies a simple noise filter to the image: clusters of dark pixels, that is
+ * 8-connected components of pixels with a lightness below min_white_level,
+ * are deleted if they are not larger than intensity pixels.
  *
  * @param intensity maximum cluster size to delete
  */
 void noisefilter(Image image, uint64_t intensity, uint8_t min_white_level) {
   uint64_t count = 0;
-  Rectangle area = full_image(image);
 
   verboseLog(VERBOSE_NORMAL, "noise-filter ...");
 
-  scan_rectangle(area) {
-    Point p = {x, y};
+  ComponentTable table = find_dark_components(image, min_white_level);
 
-    uint8_t darkness = get_pixel_darkness_inverse(image, p);
-    if (darkness < min_white_level) { // one dark pixel found
-      // get number of non-light pixels in neighborhood
-      uint64_t neighbors = noisefilter_count_pixel_neighbors(
-          image, p, intensity, min_white_level);
+  for (size_t i = 0; i < table.components_count; i++) {
+    if (table.components[i].size <= intensity) {
+      count++;
+    }
+  }
 
-      // If not more than 'intensity', delete area.
-      if (neighbors <= intensity) {
-        noisefilter_clear_pixel_neighbors(image, p, min_white_level);
-        count++;
-      }
+  for (size_t i = 0; i < table.runs_count; i++) {
+    const ComponentRun run = table.runs[i];
+
+    if (table.components[run.component].size <= intensity) {
+      wipe_rectangle(
+          image,
+          (Rectangle){{{run.first_x, run.y}, {run.last_x, run.y}}},
+          PIXEL_WHITE);
     }
   }
 
+  free_component_table(&table);
+
   verboseLog(VERBOSE_NORMAL, " deleted %" PRIu64 " clusters.\n", count);
 }
 
@@ -353,36 +497,155 @@ bool validate_grayfilter_parameters(GrayfilterParameters *params,
   return true;
 }
 
+/**
+ * Sums of the pixels of each column of the image, over the rows of the current
+ * row of grayfilter windows. They always reflect the current content of the
+ * image, so that the statistics of any window of the row only need a sliding
+ * sum over its columns.
+ */
+typedef struct {
+  Image image;
+  int32_t first_y;
+  int32_t end_y;
+  // Number of pixels with a brightness up to the black threshold.
+  uint64_t *dark;
+  uint64_t *lightness;
+  uint8_t *grayscale_row;
+  uint8_t *lightness_row;
+} GrayfilterColumns;
+
+static void grayfilter_sum_row(GrayfilterColumns *columns, int32_t y,
+                               bool remove) {
+  const int32_t width = size_of_image(columns->image).width;
+
+  get_grayscale_span(columns->image, (Point){0, y}, width,
+                     columns->grayscale_row);
+  get_lightness_span(columns->image, (Point){0, y}, width,
+                     columns->lightness_row);
+  for (int32_t x = 0; x < width; x++) {
+    const uint64_t dark =
+        columns->grayscale_row[x] <= columns->image.abs_black_threshold;
+    if (remove) {
+      columns->dark[x] -= dark;
+      columns->lightness[x] -= columns->lightness_row[x];
+    } else {
+      columns->dark[x] += dark;
+      columns->lightness[x] += columns->lightness_row[x];
+    }
+  }
+}
+
+static void grayfilter_move_rows(GrayfilterColumns *columns, int32_t first_y,
+                                 int32_t end_y) {
+  const size_t width = size_of_image(columns->image).width;
+
+  if (first_y >= columns->end_y) {
+    memset(columns->dark, 0, width * sizeof(uint64_t));
+    memset(columns->lightness, 0, width * sizeof(uint64_t));
+    columns->first_y = columns->end_y = first_y;
+  }
+
+  for (int32_t y = columns->first_y; y < first_y; y++) {
+    grayfilter_sum_row(columns, y, true);
+  }
+  for (int32_t y = columns->end_y; y < end_y; y++) {
+    grayfilter_sum_row(columns, y, false);
+  }
+
+  columns->first_y = first_y;
+  columns->end_y = end_y;
+}
+
+// Wipes an area of the current rows, and returns by how much that raised the
+// sum of its lightness. The area has no dark pixels, so their count does not
+// change.
+static uint64_t grayfilter_wipe(GrayfilterColumns *columns, Rectangle area,
+                                uint64_t *deleted) {
+  const int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+  uint64_t raised = 0;
+
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+    get_lightness_span(columns->image, (Point){area.vertex[0].x, y}, width,
+                       columns->lightness_row);
+    for (int32_t i = 0; i < width; i++) {
+      const uint64_t raise = UINT8_MAX - columns->lightness_row[i];
+      columns->lightness[area.vertex[0].x + i] += raise;
+      raised += raise;
+      *deleted += raise != 0;
+    }
+  }
+
+  wipe_rectangle(columns->image, area, PIXEL_WHITE);
+  return raised;
+}
+
 void grayfilter(Image image, GrayfilterParameters params) {
   RectangleSize image_size = size_of_image(image);
-  Point filter_origin = POINT_ORIGIN;
   uint64_t count = 0;
 
   verboseLog(VERBOSE_NORMAL, "gray-filter...");
 
-  do {
-    Rectangle area = rectangle_from_size(filter_origin, params.scan_size);
-    uint64_t count = count_pixels_within_brightness(
-        image, area, 0, image.abs_black_threshold, false);
-
-    if (count == 0) {
-      uint8_t lightness = inverse_lightness_rect(image, area);
-      // (lower threshold->more deletion)
-      if (lightness < params.abs_threshold) {
-        count += count_pixels(area);
-        wipe_rectangle(image, area, PIXEL_WHITE);
+  GrayfilterColumns columns = {.image = image};
+  columns.dark = malloc(image_size.width * sizeof(uint64_t));
+  columns.lightness = malloc(image_size.width * sizeof(uint64_t));
+  columns.grayscale_row = malloc(image_size.width);
+  columns.lightness_row = malloc(image_size.width);
+  if (columns.dark == NULL || columns.lightness == NULL ||
+      columns.grayscale_row == NULL || columns.lightness_row == NULL) {
+    errOutput("unable to allocate grayfilter buffers.");
+  }
+
+  // Windows are processed row by row, and left to right, each one seeing the
+  // wipes of the previous ones. Windows entirely outside of the image have no
+  // pixels to wipe, and are skipped.
+  for (int32_t top = 0; top < image_size.height;
+       top += params.scan_step.vertical) {
+    grayfilter_move_rows(&columns, top,
+                         min(top + params.scan_size.height, image_size.height));
+
+    // Sums over the columns from first_x to end_x (excluded).
+    int32_t first_x = 0, end_x = 0;
+    uint64_t dark = 0, lightness = 0;
+
+    for (int32_t left = 0; left < image_size.width;
+         left += params.scan_step.horizontal) {
+      const int32_t right =
+          min(left + params.scan_size.width, image_size.width);
+
+      if (left >= end_x) {
+        dark = lightness = 0;
+        first_x = end_x = left;
+      }
+      for (; first_x < left; first_x++) {
+        dark -= columns.dark[first_x];
+        lightness -= columns.lightness[first_x];
+      }
+      for (; end_x < right; end_x++) {
+        dark += columns.dark[end_x];
+        lightness += columns.lightness[end_x];
       }
-    }
 
-    // Continue on the same row unless we reached the end of the row.
-    if (filter_origin.x < image_size.width) {
-      filter_origin.x += params.scan_step.horizontal;
-    } else {
-      // next row:
-      filter_origin.x = 0;
-      filter_origin.y += params.scan_step.vertical;
+      if (dark != 0) {
+        continue;
+      }
+
+      const Rectangle area = {
+          {{left, columns.first_y}, {right - 1, columns.end_y - 1}}};
+      const uint64_t pixels = count_pixels(area);
+
+      // (lower threshold->more deletion), windows already wiped by the
+      // previous ones are left alone.
+      if (0xFF - (lightness / pixels) < params.abs_threshold &&
+          lightness != pixels * UINT8_MAX) {
+        lightness += grayfilter_wipe(&columns, area, &count);
+      }
     }
-  } while (filter_origin.y <= image_size.height);
+  }
+
+  free(columns.dark);
+  free(columns.lightness);
+  free(columns.grayscale_row);
+  free(columns.lightness_row);
 
   verboseLog(VERBOSE_NORMAL, " deleted %" PRIu64 " pixels.\n", count);
 }
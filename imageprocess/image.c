@@ -2,7 +2,13 @@
 //
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libavutil/buffer.h>
 #include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/common.h>
 
 #include "imageprocess/blit.h"
 #include "imageprocess/image.h"
@@ -10,9 +16,73 @@
 #include "lib/logging.h"
 #include "lib/math_util.h"
 
+// Alignment of the rows of the images, in bytes.
+#define LINESIZE_ALIGN 8
+
+// Spare bytes at the end of every image buffer, as av_frame_get_buffer()
+// also allocates, so that code reading whole words never reads past it.
+#define BUFFER_PADDING 64
+
+// Maximum number of distinct buffer sizes to keep pools for.
+#define MAX_BUFFER_POOLS 16
+
+/**
+ * Pools of buffers, keyed by their size, for the pixel data of the images and
+ * the other large per-image allocations.
+ *
+ * Processing a sheet allocates and frees several images of the same few
+ * sizes, and the sheets of a batch are usually all the same size, so after
+ * the first sheet the buffers are recycled rather than allocated again. When
+ * all the slots are taken, the pool that was used least recently is released;
+ * its buffers are freed once they are no longer referenced.
+ *
+ * The pools are not thread-safe: images are only created from the main
+ * thread.
+ */
+static struct {
+  size_t size;
+  AVBufferPool *pool;
+  uint64_t last_used;
+} buffer_pools[MAX_BUFFER_POOLS];
+
+static uint64_t buffer_pools_clock = 0;
+
+AVBufferRef *get_pooled_buffer(size_t size) {
+  size_t slot = 0;
+
+  for (size_t i = 0; i < MAX_BUFFER_POOLS; i++) {
+    if (buffer_pools[i].pool != NULL && buffer_pools[i].size == size) {
+      slot = i;
+      break;
+    }
+    if (buffer_pools[i].last_used < buffer_pools[slot].last_used) {
+      slot = i;
+    }
+  }
+
+  if (buffer_pools[slot].pool == NULL || buffer_pools[slot].size != size) {
+    av_buffer_pool_uninit(&buffer_pools[slot].pool);
+    buffer_pools[slot].size = size;
+    buffer_pools[slot].pool = av_buffer_pool_init(size, NULL);
+    if (buffer_pools[slot].pool == NULL) {
+      return NULL;
+    }
+  }
+
+  buffer_pools[slot].last_used = ++buffer_pools_clock;
+  return av_buffer_pool_get(buffer_pools[slot].pool);
+}
+
+void free_buffer_pools(void) {
+  for (size_t i = 0; i < MAX_BUFFER_POOLS; i++) {
+    av_buffer_pool_uninit(&buffer_pools[i].pool);
+  }
+}
+
 /**
  * Allocates a memory block for storing image data and fills the AVFrame-struct
- * with the specified values.
+ * with the specified values. All the pixel formats used for images store
+ * their pixels in a single plane, which is taken from the buffer pools.
  */
 Image create_image(RectangleSize size, int pixel_format, bool fill,
                    Pixel sheet_background, uint8_t abs_black_threshold) {
@@ -26,12 +96,20 @@ Image create_image(RectangleSize size, int pixel_format, bool fill,
   image.frame->height = size.height;
   image.frame->format = pixel_format;
 
-  int ret = av_frame_get_buffer(image.frame, 8);
-  if (ret < 0) {
-    char errbuff[1024];
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to allocate buffer: %s", errbuff);
+  int linesize = av_image_get_linesize(pixel_format, size.width, 0);
+  if (linesize <= 0 || size.height <= 0) {
+    errOutput("unable to allocate buffer: invalid image size or format");
+  }
+  linesize = FFALIGN(linesize, LINESIZE_ALIGN);
+
+  image.frame->buf[0] =
+      get_pooled_buffer((size_t)linesize * size.height + BUFFER_PADDING);
+  if (image.frame->buf[0] == NULL) {
+    errOutput("unable to allocate buffer");
   }
+  image.frame->data[0] = image.frame->buf[0]->data;
+  image.frame->linesize[0] = linesize;
+  image.frame->extended_data = image.frame->data;
 
   if (fill) {
     wipe_rectangle(image, full_image(image), image.background);
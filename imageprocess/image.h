@@ -7,6 +7,7 @@
 #include "imageprocess/primitives.h"
 
 typedef struct AVFrame AVFrame;
+typedef struct AVBufferRef AVBufferRef;
 
 typedef struct {
   AVFrame *frame;
@@ -23,6 +24,9 @@ void replace_image(Image *image, Image *new_image);
 void free_image(Image *image);
 Image create_compatible_image(Image source, RectangleSize size, bool fill);
 
+AVBufferRef *get_pooled_buffer(size_t size);
+void free_buffer_pools(void);
+
 RectangleSize size_of_image(Image image);
 Rectangle full_image(Image image);
 Rectangle clip_rectangle(Image image, Rectangle area);
@@ -0,0 +1,248 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/integral.h"
+#include "imageprocess/pixel.h"
+#include "lib/math_util.h"
+
+/**
+ * Integral images (summed-area tables) of the per-pixel values that the
+ * filters and the mask and border detection add up over rectangles.
+ *
+ * Each entry of a table holds the sum of the values of all the pixels above
+ * and to the left of it, so that the sum over any rectangle only needs four
+ * entries. Entries are stored as unsigned 32-bit integers: since the
+ * differences are computed modulo 2^32, the result is exact as long as the
+ * sum over the rectangle itself fits in 32 bits.
+ *
+ * The tables are attached to the frame of the image, so that all the copies
+ * of an Image share them and they are released together with the frame, and
+ * are invalidated by get_writable_pixel_row(). Building a table costs as much
+ * as scanning the whole image once, so it is only (re)built once the callers
+ * have scanned as many pixels directly since the last change to the image:
+ * code that alternates between queries and writes, like the filters, is then
+ * at most twice as slow as without the tables.
+ */
+
+// Number of pixels read at once while building a table.
+#define BUILD_SPAN_SIZE 512
+
+typedef struct {
+  AVBufferRef *buffer;
+  uint32_t *table;
+  bool valid;
+  // Pixels scanned by the callers since the table was last invalidated.
+  uint64_t scanned_pixels;
+  // Brightness range counted by the INTEGRAL_BRIGHTNESS_RANGE table.
+  uint8_t min_brightness;
+  uint8_t max_brightness;
+} IntegralTable;
+
+typedef struct {
+  IntegralTable tables[INTEGRAL_STATISTICS_COUNT];
+} IntegralImages;
+
+static void free_integral_images(void *opaque, uint8_t *data) {
+  (void)opaque;
+  IntegralImages *integrals = (IntegralImages *)data;
+
+  for (int i = 0; i < INTEGRAL_STATISTICS_COUNT; i++) {
+    av_buffer_unref(&integrals->tables[i].buffer);
+  }
+  av_free(integrals);
+}
+
+static IntegralImages *get_integral_images(Image image) {
+  if (image.frame->opaque_ref == NULL) {
+    IntegralImages *integrals = av_mallocz(sizeof(IntegralImages));
+    if (integrals == NULL) {
+      return NULL;
+    }
+
+    image.frame->opaque_ref =
+        av_buffer_create((uint8_t *)integrals, sizeof(IntegralImages),
+                         free_integral_images, NULL, 0);
+    if (image.frame->opaque_ref == NULL) {
+      av_free(integrals);
+      return NULL;
+    }
+  }
+
+  return (IntegralImages *)image.frame->opaque_ref->data;
+}
+
+static void read_values(Image image, IntegralStatistic statistic,
+                        const IntegralTable *table, Point start,
+                        int32_t count, uint8_t *out) {
+  switch (statistic) {
+  case INTEGRAL_GRAYSCALE:
+    get_grayscale_span(image, start, count, out);
+    break;
+  case INTEGRAL_LIGHTNESS:
+    get_lightness_span(image, start, count, out);
+    break;
+  case INTEGRAL_DARKNESS_INVERSE:
+    get_darkness_inverse_span(image, start, count, out);
+    break;
+  case INTEGRAL_BRIGHTNESS_RANGE:
+    get_grayscale_span(image, start, count, out);
+    for (int32_t i = 0; i < count; i++) {
+      out[i] = out[i] >= table->min_brightness &&
+               out[i] <= table->max_brightness;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static bool build_table(Image image, IntegralStatistic statistic,
+                        IntegralTable *table) {
+  const int32_t width = image.frame->width;
+  const int32_t height = image.frame->height;
+  const size_t stride = (size_t)width + 1;
+
+  if (table->buffer == NULL) {
+    table->buffer =
+        get_pooled_buffer(stride * ((size_t)height + 1) * sizeof(uint32_t));
+    if (table->buffer == NULL) {
+      return false;
+    }
+    table->table = (uint32_t *)table->buffer->data;
+  }
+
+  memset(table->table, 0, stride * sizeof(uint32_t));
+
+  uint8_t values[BUILD_SPAN_SIZE];
+  for (int32_t y = 0; y < height; y++) {
+    const uint32_t *above = table->table + (size_t)y * stride;
+    uint32_t *current = table->table + ((size_t)y + 1) * stride;
+    uint32_t row_sum = 0;
+
+    current[0] = 0;
+    for (int32_t x = 0; x < width; x += BUILD_SPAN_SIZE) {
+      const int32_t length = min(BUILD_SPAN_SIZE, width - x);
+
+      read_values(image, statistic, table, (Point){x, y}, length, values);
+      for (int32_t i = 0; i < length; i++) {
+        row_sum += values[i];
+        current[x + i + 1] = above[x + i + 1] + row_sum;
+      }
+    }
+  }
+
+  table->valid = true;
+  return true;
+}
+
+static bool lookup(Image image, IntegralStatistic statistic, Rectangle area,
+                   uint8_t min_brightness, uint8_t max_brightness,
+                   uint64_t *result) {
+  // Areas clipped to an image they do not overlap end up inverted, and
+  // contain no pixels.
+  if (area.vertex[0].x > area.vertex[1].x ||
+      area.vertex[0].y > area.vertex[1].y) {
+    *result = 0;
+    return true;
+  }
+
+  const uint64_t pixels = count_pixels(area);
+  if (statistic != INTEGRAL_BRIGHTNESS_RANGE &&
+      pixels > UINT32_MAX / UINT8_MAX) {
+    return false;
+  }
+
+  // Images with a single channel have the same grayscale, lightness and
+  // inverse darkness, so they can share a single table.
+  if (statistic != INTEGRAL_BRIGHTNESS_RANGE &&
+      image.frame->format != AV_PIX_FMT_RGB24) {
+    statistic = INTEGRAL_GRAYSCALE;
+  }
+
+  IntegralImages *integrals = get_integral_images(image);
+  if (integrals == NULL) {
+    return false;
+  }
+
+  IntegralTable *table = &integrals->tables[statistic];
+  if (statistic == INTEGRAL_BRIGHTNESS_RANGE &&
+      (table->min_brightness != min_brightness ||
+       table->max_brightness != max_brightness)) {
+    table->valid = false;
+    table->scanned_pixels = 0;
+    table->min_brightness = min_brightness;
+    table->max_brightness = max_brightness;
+  }
+
+  if (!table->valid) {
+    table->scanned_pixels += pixels;
+    if (table->scanned_pixels < count_pixels(full_image(image)) ||
+        !build_table(image, statistic, table)) {
+      return false;
+    }
+  }
+
+  const size_t stride = (size_t)image.frame->width + 1;
+  const uint32_t *top = table->table + (size_t)area.vertex[0].y * stride;
+  const uint32_t *bottom =
+      table->table + ((size_t)area.vertex[1].y + 1) * stride;
+
+  *result = (uint32_t)(bottom[area.vertex[1].x + 1] - bottom[area.vertex[0].x] -
+                       top[area.vertex[1].x + 1] + top[area.vertex[0].x]);
+  return true;
+}
+
+/**
+ * Sums the values of a statistic over an area of the image, which must have
+ * been clipped to the image.
+ *
+ * @return false if no integral image is available for the statistic, in which
+ * case the caller is expected to scan the area itself.
+ */
+bool integral_sum(Image image, IntegralStatistic statistic, Rectangle area,
+                  uint64_t *result) {
+  return lookup(image, statistic, area, 0, 0, result);
+}
+
+/**
+ * Counts the pixels with a brightness between min_brightness and
+ * max_brightness (inclusive) in an area of the image, which must have been
+ * clipped to the image.
+ *
+ * @return false if no integral image is available for the range, in which
+ * case the caller is expected to scan the area itself.
+ */
+bool integral_count_within_brightness(Image image, Rectangle area,
+                                      uint8_t min_brightness,
+                                      uint8_t max_brightness,
+                                      uint64_t *result) {
+  return lookup(image, INTEGRAL_BRIGHTNESS_RANGE, area, min_brightness,
+                max_brightness, result);
+}
+
+/**
+ * Drops the integral images cached for the image, which has been or is about
+ * to be modified.
+ */
+void invalidate_integral_images(Image image) {
+  if (image.frame->opaque_ref == NULL) {
+    return;
+  }
+
+  IntegralImages *integrals = (IntegralImages *)image.frame->opaque_ref->data;
+  for (int i = 0; i < INTEGRAL_STATISTICS_COUNT; i++) {
+    integrals->tables[i].valid = false;
+    integrals->tables[i].scanned_pixels = 0;
+  }
+}
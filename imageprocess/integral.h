@@ -0,0 +1,27 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+typedef enum {
+  INTEGRAL_GRAYSCALE,
+  INTEGRAL_LIGHTNESS,
+  INTEGRAL_DARKNESS_INVERSE,
+  INTEGRAL_BRIGHTNESS_RANGE,
+  INTEGRAL_STATISTICS_COUNT,
+} IntegralStatistic;
+
+bool integral_sum(Image image, IntegralStatistic statistic, Rectangle area,
+                  uint64_t *result);
+bool integral_count_within_brightness(Image image, Rectangle area,
+                                      uint8_t min_brightness,
+                                      uint8_t max_brightness,
+                                      uint64_t *result);
+void invalidate_integral_images(Image image);
@@ -3,120 +3,191 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <math.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <libavutil/common.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
 
 #include "imageprocess/interpolate.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/pixel_formats.h"
+#include "lib/logging.h"
+#include "lib/math_util.h"
 
-Pixel interp_nearest_neighbour(Image image, FloatPoint coords) {
-  // Round to nearest location.
-  Point p = {(int)roundf(coords.x), (int)roundf(coords.y)};
+/**
+ * All interpolations work on fixed-point coordinates, so that the source
+ * pixels and weights only depend on integer arithmetic: the results are the
+ * same whatever the compiler does with floating point expressions.
+ */
 
-  return get_pixel(image, p);
+int64_t fixed_from_float(float value) {
+  return llround((double)value * FIXED_POINT_ONE);
+}
+
+static inline int32_t fixed_ceil(int64_t value) { return -fixed_floor(-value); }
+
+// Rounds half away from zero, as roundf().
+static inline int32_t fixed_round(int64_t value) {
+  return value < 0 ? -fixed_floor(FIXED_POINT_HALF - value)
+                   : fixed_floor(value + FIXED_POINT_HALF);
 }
 
 /**
- * 1-D cubic interpolation. Clamps the return value between 0 and 255 to
- * support 8-bit colour images.
+ * Fractions of a pixel are quantized to 1 / FRACTION_STEPS for interpolation,
+ * and the weights for each step are computed once, in fixed point: a tap of
+ * weight INTERP_WEIGHT_ONE is copied through unchanged.
  */
-static uint8_t cubic_scale(float factor, uint8_t a, uint8_t b, uint8_t c,
-                           uint8_t d) {
-  int result = b + 0.5f * factor *
-                       (c - a +
-                        factor * (2.0f * a - 5.0f * b + 4.0f * c - d +
-                                  factor * (3.0f * (b - c) + d - a)));
+#define FRACTION_BITS 6
+#define FRACTION_STEPS (1 << FRACTION_BITS)
+
+static TapWeights linear_weights[FRACTION_STEPS + 1];
+static TapWeights cubic_weights[FRACTION_STEPS + 1];
+static pthread_once_t weights_once = PTHREAD_ONCE_INIT;
+
+static void build_weight_tables(void) {
+  for (int q = 0; q <= FRACTION_STEPS; q++) {
+    const double f = (double)q / FRACTION_STEPS;
+
+    linear_weights[q] = (TapWeights){
+        {0, INTERP_WEIGHT_ONE - q * (INTERP_WEIGHT_ONE / FRACTION_STEPS),
+         q * (INTERP_WEIGHT_ONE / FRACTION_STEPS), 0}};
+
+    // Catmull-Rom spline through the four taps.
+    const double cubic[4] = {
+        0.5 * f * (-1.0 + f * (2.0 - f)),
+        1.0 + 0.5 * f * f * (-5.0 + 3.0 * f),
+        0.5 * f * (1.0 + f * (4.0 - 3.0 * f)),
+        0.5 * f * f * (f - 1.0),
+    };
+    // The largest weight takes up the rounding errors of the others, so that
+    // the weights always add up to one and flat areas keep their value.
+    const int largest = (q <= FRACTION_STEPS / 2) ? 1 : 2;
+    int32_t sum = 0;
 
-  return av_clip_uint8(result);
+    for (int i = 0; i < 4; i++) {
+      if (i != largest) {
+        cubic_weights[q].tap[i] = (int32_t)lround(cubic[i] * INTERP_WEIGHT_ONE);
+        sum += cubic_weights[q].tap[i];
+      }
+    }
+    cubic_weights[q].tap[largest] = INTERP_WEIGHT_ONE - sum;
+  }
+}
+
+// Weights at the distance from base to value, quantized to the nearest step.
+static inline TapWeights weights_at(const TapWeights table[], int64_t value,
+                                    int32_t base) {
+  const int shift = FIXED_POINT_SHIFT - FRACTION_BITS;
+  const int64_t fraction = value - (int64_t)base * FIXED_POINT_ONE;
+
+  return table[(fraction + ((int64_t)1 << (shift - 1))) >> shift];
+}
+
+static inline uint8_t mix_taps(TapWeights weights, uint8_t a, uint8_t b,
+                               uint8_t c, uint8_t d) {
+  return av_clip_uint8((weights.tap[0] * a + weights.tap[1] * b +
+                        weights.tap[2] * c + weights.tap[3] * d) >>
+                       INTERP_WEIGHT_SHIFT);
 }
 
-// 1-D cubic interpolation
-static Pixel cubic_pixel_interpolation(float factor, Pixel pxls[4]) {
+// 1-D interpolation of four pixels. Clamps each component between 0 and 255,
+// as cubic interpolation can overshoot.
+static inline Pixel mix_tap_pixels(TapWeights weights, Pixel a, Pixel b,
+                                   Pixel c, Pixel d) {
   return (Pixel){
-      .r = cubic_scale(factor, pxls[0].r, pxls[1].r, pxls[2].r, pxls[3].r),
-      .g = cubic_scale(factor, pxls[0].g, pxls[1].g, pxls[2].g, pxls[3].g),
-      .b = cubic_scale(factor, pxls[0].b, pxls[1].b, pxls[2].b, pxls[3].b),
+      .r = mix_taps(weights, a.r, b.r, c.r, d.r),
+      .g = mix_taps(weights, a.g, b.g, c.g, d.g),
+      .b = mix_taps(weights, a.b, b.b, c.b, d.b),
   };
 }
 
-// 2-D bicubic interpolation
-Pixel interp_bicubic(Image image, FloatPoint coords) {
-  Point p = {(int)coords.x, (int)coords.y};
-
+// 2-D bicubic interpolation of a 4x4 square of pixels, in rows.
+static inline Pixel bicubic_mix(TapWeights weights_x, TapWeights weights_y,
+                                const Pixel quads[4][4]) {
   Pixel pxls[4];
 
-  for (int i = -1; i < 3; ++i) {
-    Pixel quad[4] = {
-        get_pixel(image, (Point){p.x - 1, p.y + i}),
-        get_pixel(image, (Point){p.x, p.y + i}),
-        get_pixel(image, (Point){p.x + 1, p.y + i}),
-        get_pixel(image, (Point){p.x + 2, p.y + i}),
-    };
-    pxls[i + 1] = cubic_pixel_interpolation(coords.x - p.x, quad);
+  for (int i = 0; i < 4; ++i) {
+    pxls[i] = mix_tap_pixels(weights_x, quads[i][0], quads[i][1], quads[i][2],
+                             quads[i][3]);
   }
 
-  return cubic_pixel_interpolation(coords.y - p.y, pxls);
+  return mix_tap_pixels(weights_y, pxls[0], pxls[1], pxls[2], pxls[3]);
 }
 
-static uint8_t linear_scale(float x, uint8_t a, uint8_t b) {
-  return (1.0f - x) * a + x * b;
+static inline uint8_t linear_scale(TapWeights weights, uint8_t a, uint8_t b) {
+  return (weights.tap[1] * a + weights.tap[2] * b) >> INTERP_WEIGHT_SHIFT;
 }
 
 // 1-D linear interpolation
-static Pixel linear_pixel_interpolation(float factor, Pixel a, Pixel b) {
+static inline Pixel linear_pixel_interpolation(TapWeights weights, Pixel a,
+                                               Pixel b) {
   return (Pixel){
-      .r = linear_scale(factor, a.r, b.r),
-      .g = linear_scale(factor, a.g, b.g),
-      .b = linear_scale(factor, a.b, b.b),
+      .r = linear_scale(weights, a.r, b.r),
+      .g = linear_scale(weights, a.g, b.g),
+      .b = linear_scale(weights, a.b, b.b),
   };
 }
 
-// 2-D linear interpolation
-Pixel interp_bilinear(Image image, FloatPoint coords) {
-  Rectangle image_area = full_image(image);
+// 2-D linear interpolation of a 2x2 square of pixels, top row first.
+static inline Pixel bilinear_mix(TapWeights weights_x, TapWeights weights_y,
+                                 Pixel pxl1, Pixel pxl2, Pixel pxl3,
+                                 Pixel pxl4) {
+  Pixel pxl_h1 = linear_pixel_interpolation(weights_x, pxl1, pxl2);
+  Pixel pxl_h2 = linear_pixel_interpolation(weights_x, pxl3, pxl4);
+  return linear_pixel_interpolation(weights_y, pxl_h1, pxl_h2);
+}
 
-  Point p1 = {(int)floorf(coords.x), (int)floorf(coords.y)};
-  Point p2 = {(int)ceil(coords.x), (int)ceilf(coords.y)};
+static Pixel interp_nearest_neighbour(Image image, FixedPoint coords) {
+  // Round to nearest location.
+  Point p = {fixed_round(coords.x), fixed_round(coords.y)};
 
-  // Check edge conditions to avoid divide-by-zero
-  if (!point_in_rectangle(p2, image_area)) {
-    return get_pixel(image, p1);
-  }
+  return get_pixel(image, p);
+}
 
-  // Single pixel.
-  if (p1.x == p2.x && p1.y == p2.y) {
-    return get_pixel(image, p1);
+// 2-D bicubic interpolation
+static Pixel interp_bicubic(Image image, FixedPoint coords) {
+  Point p = {fixed_floor(coords.x), fixed_floor(coords.y)};
+  Pixel quads[4][4];
+
+  for (int i = -1; i < 3; ++i) {
+    for (int j = -1; j < 3; ++j) {
+      quads[i + 1][j + 1] = get_pixel(image, (Point){p.x + j, p.y + i});
+    }
   }
 
-  // 2D vertical interpolation.
-  if (p1.x == p2.x) {
-    Pixel pxl1 = get_pixel(image, p1);
-    Pixel pxl2 = get_pixel(image, p2);
+  return bicubic_mix(weights_at(cubic_weights, coords.x, p.x),
+                     weights_at(cubic_weights, coords.y, p.y), quads);
+}
 
-    return linear_pixel_interpolation(coords.x - p1.x, pxl1, pxl2);
-  }
+// 2-D linear interpolation
+static Pixel interp_bilinear(Image image, FixedPoint coords) {
+  Rectangle image_area = full_image(image);
 
-  // 2D horizontal interpolation.
-  if (p1.y == p2.y) {
-    Pixel pxl1 = get_pixel(image, p1);
-    Pixel pxl2 = get_pixel(image, p2);
+  Point p1 = {fixed_floor(coords.x), fixed_floor(coords.y)};
+  Point p2 = {fixed_ceil(coords.x), fixed_ceil(coords.y)};
 
-    return linear_pixel_interpolation(coords.y - p1.y, pxl1, pxl2);
+  // Check edge conditions to avoid divide-by-zero. On a row or column of
+  // the source, the interpolation factor is 0, so the pixel at p1 is taken.
+  // Stretching (see resample.c) still interpolates along the other direction
+  // there, so deskewing and stretching disagree on those pixels.
+  if (!point_in_rectangle(p2, image_area) || p1.x == p2.x || p1.y == p2.y) {
+    return get_pixel(image, p1);
   }
 
   // Get the four pixels in a square.
-  Pixel pxl1 = get_pixel(image, (Point){p1.x, p1.y});
-  Pixel pxl2 = get_pixel(image, (Point){p2.x, p1.y});
-  Pixel pxl3 = get_pixel(image, (Point){p1.x, p2.y});
-  Pixel pxl4 = get_pixel(image, (Point){p2.x, p2.y});
-
-  Pixel pxl_h1 = linear_pixel_interpolation(coords.x - p1.x, pxl1, pxl2);
-  Pixel pxl_h2 = linear_pixel_interpolation(coords.x - p1.x, pxl3, pxl4);
-  return linear_pixel_interpolation(coords.y - p1.y, pxl_h1, pxl_h2);
+  return bilinear_mix(weights_at(linear_weights, coords.x, p1.x),
+                      weights_at(linear_weights, coords.y, p1.y),
+                      get_pixel(image, (Point){p1.x, p1.y}),
+                      get_pixel(image, (Point){p2.x, p1.y}),
+                      get_pixel(image, (Point){p1.x, p2.y}),
+                      get_pixel(image, (Point){p2.x, p2.y}));
 }
 
-Pixel interpolate(Image image, FloatPoint coords, Interpolation function) {
+static Pixel interpolate_fixed(Image image, FixedPoint coords,
+                               Interpolation function) {
   switch (function) {
   case INTERP_NN:
     return interp_nearest_neighbour(image, coords);
@@ -127,3 +198,189 @@ Pixel interpolate(Image image, FloatPoint coords, Interpolation function) {
     return interp_bicubic(image, coords);
   }
 }
+
+/**
+ * Returns the weights of the taps for 1-D interpolation at fraction (in fixed
+ * point, between 0 and 1) of the way from the second tap to the third one.
+ * Only cubic interpolation gives weight to the outer taps.
+ */
+TapWeights tap_weights(int64_t fraction, Interpolation function) {
+  pthread_once(&weights_once, build_weight_tables);
+
+  switch (function) {
+  case INTERP_NN:
+    return (TapWeights){{0, (fraction < FIXED_POINT_HALF) * INTERP_WEIGHT_ONE,
+                         (fraction >= FIXED_POINT_HALF) * INTERP_WEIGHT_ONE,
+                         0}};
+  case INTERP_LINEAR:
+    return weights_at(linear_weights, fraction, 0);
+  case INTERP_CUBIC:
+  default:
+    return weights_at(cubic_weights, fraction, 0);
+  }
+}
+
+/**
+ * Interpolates count pixels along a span of taps with the same weights: each
+ * output pixel out[i] mixes taps[i] to taps[i + 3].
+ */
+void interpolate_span(const Pixel *taps, TapWeights weights, int32_t count,
+                      Pixel *out) {
+  for (int32_t i = 0; i < count; i++) {
+    out[i] = mix_tap_pixels(weights, taps[i], taps[i + 1], taps[i + 2],
+                            taps[i + 3]);
+  }
+}
+
+/**
+ * Interpolates count pixels across four rows of taps, each with its own
+ * weights: each output pixel out[i] mixes the pixels i of the rows.
+ */
+void interpolate_across(const Pixel *const rows[4], const TapWeights weights[],
+                        int32_t count, Pixel *out) {
+  for (int32_t i = 0; i < count; i++) {
+    out[i] = mix_tap_pixels(weights[i], rows[0][i], rows[1][i], rows[2][i],
+                            rows[3][i]);
+  }
+}
+
+/**
+ * Per-format copies of the interpolations, for lines whose pixels all fall
+ * within the image: they read the source rows directly, without any bounds
+ * check. Each is equivalent to the function above with the same name.
+ */
+#define DEFINE_LINE_INTERPOLATIONS(name, format)                               \
+  static void name##_nearest_line(const uint8_t *data, ptrdiff_t linesize,     \
+                                  FixedPoint p, FixedPoint step,               \
+                                  int32_t count, Pixel *out) {                 \
+    for (int32_t i = 0; i < count; i++, p.x += step.x, p.y += step.y) {        \
+      out[i] = name##_get(data + fixed_round(p.y) * linesize,                  \
+                          fixed_round(p.x));                                   \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void name##_bilinear_line(const uint8_t *data, ptrdiff_t linesize,    \
+                                   FixedPoint p, FixedPoint step,              \
+                                   int32_t count, Pixel *out) {                \
+    for (int32_t i = 0; i < count; i++, p.x += step.x, p.y += step.y) {        \
+      const int32_t x = fixed_floor(p.x), y = fixed_floor(p.y);                \
+      const uint8_t *row = data + y * linesize;                                \
+                                                                               \
+      if (p.x == (int64_t)x * FIXED_POINT_ONE ||                               \
+          p.y == (int64_t)y * FIXED_POINT_ONE) {                               \
+        out[i] = name##_get(row, x);                                           \
+        continue;                                                              \
+      }                                                                        \
+      out[i] = bilinear_mix(weights_at(linear_weights, p.x, x),                \
+                            weights_at(linear_weights, p.y, y),                \
+                            name##_get(row, x),                                \
+                            name##_get(row, x + 1),                            \
+                            name##_get(row + linesize, x),                     \
+                            name##_get(row + linesize, x + 1));                \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void name##_bicubic_line(const uint8_t *data, ptrdiff_t linesize,     \
+                                  FixedPoint p, FixedPoint step,               \
+                                  int32_t count, Pixel *out) {                 \
+    for (int32_t i = 0; i < count; i++, p.x += step.x, p.y += step.y) {        \
+      const int32_t x = fixed_floor(p.x), y = fixed_floor(p.y);                \
+      Pixel quads[4][4];                                                       \
+                                                                               \
+      for (int j = 0; j < 4; j++) {                                            \
+        const uint8_t *row = data + (y + j - 1) * linesize;                    \
+        for (int k = 0; k < 4; k++) {                                          \
+          quads[j][k] = name##_get(row, x + k - 1);                            \
+        }                                                                      \
+      }                                                                        \
+      out[i] = bicubic_mix(weights_at(cubic_weights, p.x, x),                  \
+                           weights_at(cubic_weights, p.y, y), quads);          \
+    }                                                                          \
+  }
+
+FOR_EACH_PIXEL_FORMAT(DEFINE_LINE_INTERPOLATIONS)
+
+#undef DEFINE_LINE_INTERPOLATIONS
+
+// Whether all the pixels read to interpolate along the line from first to
+// last are within the image, when the interpolation reads before pixels up
+// and left of each point, and after pixels down and right of it.
+static bool line_within_image(Image image, FixedPoint first, FixedPoint last,
+                              int32_t before, int32_t after) {
+  const RectangleSize size = size_of_image(image);
+  const int32_t first_x = fixed_floor(min(first.x, last.x));
+  const int32_t first_y = fixed_floor(min(first.y, last.y));
+  const int32_t last_x = fixed_floor(max(first.x, last.x));
+  const int32_t last_y = fixed_floor(max(first.y, last.y));
+
+  return first_x - before >= 0 && first_y - before >= 0 &&
+         last_x + after < size.width && last_y + after < size.height;
+}
+
+/**
+ * Interpolates a single pixel of the image. Away from the borders of the
+ * image, the pixels around it are read directly from its rows, as for a line.
+ */
+Pixel interpolate(Image image, FloatPoint coords, Interpolation function) {
+  const FixedPoint fixed = {fixed_from_float(coords.x),
+                            fixed_from_float(coords.y)};
+  Pixel pixel;
+
+  interpolate_line(image, fixed, (FixedPoint){0, 0}, 1, function, &pixel);
+  return pixel;
+}
+
+/**
+ * Interpolates count pixels of the image along a line, starting at start and
+ * moving by step for each pixel. Lines that stay clear of the borders of the
+ * image are interpolated directly from its rows.
+ */
+void interpolate_line(Image image, FixedPoint start, FixedPoint step,
+                      int32_t count, Interpolation function, Pixel *out) {
+  if (count <= 0) {
+    return;
+  }
+  pthread_once(&weights_once, build_weight_tables);
+
+  // Pixels up/left and down/right of each point read by the interpolation.
+  const int32_t before = (function == INTERP_CUBIC) ? 1 : 0;
+  const int32_t after = (function == INTERP_CUBIC) ? 2 : 1;
+  const FixedPoint last = {start.x + (count - 1) * step.x,
+                           start.y + (count - 1) * step.y};
+
+  if (!line_within_image(image, start, last, before, after)) {
+    for (int32_t i = 0; i < count; i++) {
+      out[i] = interpolate_fixed(image, start, function);
+      start.x += step.x;
+      start.y += step.y;
+    }
+    return;
+  }
+
+  const uint8_t *data = image.frame->data[0];
+  const ptrdiff_t linesize = image.frame->linesize[0];
+
+#define LINE_INTERPOLATION_CASE(name, format)                                  \
+  case format:                                                                 \
+    switch (function) {                                                        \
+    case INTERP_NN:                                                            \
+      name##_nearest_line(data, linesize, start, step, count, out);            \
+      break;                                                                   \
+    case INTERP_LINEAR:                                                        \
+      name##_bilinear_line(data, linesize, start, step, count, out);           \
+      break;                                                                   \
+    case INTERP_CUBIC:                                                         \
+    default:                                                                   \
+      name##_bicubic_line(data, linesize, start, step, count, out);            \
+      break;                                                                   \
+    }                                                                          \
+    break;
+
+  switch (image.frame->format) {
+    FOR_EACH_PIXEL_FORMAT(LINE_INTERPOLATION_CASE)
+  default:
+    errOutput("unknown pixel format.");
+  }
+
+#undef LINE_INTERPOLATION_CASE
+}
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include "imageprocess/image.h"
 #include "imageprocess/primitives.h"
 
@@ -14,4 +16,38 @@ typedef enum {
   INTERP_FUNCTIONS_COUNT
 } Interpolation;
 
+// Coordinates in fixed point, with FIXED_POINT_SHIFT fractional bits.
+#define FIXED_POINT_SHIFT 32
+#define FIXED_POINT_ONE ((int64_t)1 << FIXED_POINT_SHIFT)
+#define FIXED_POINT_HALF (FIXED_POINT_ONE / 2)
+
+typedef struct {
+  int64_t x;
+  int64_t y;
+} FixedPoint;
+
+int64_t fixed_from_float(float value);
+
+static inline int32_t fixed_floor(int64_t value) {
+  return (int32_t)(value >> FIXED_POINT_SHIFT);
+}
+
 Pixel interpolate(Image image, FloatPoint coords, Interpolation function);
+void interpolate_line(Image image, FixedPoint start, FixedPoint step,
+                      int32_t count, Interpolation function, Pixel *out);
+
+// Weights of four consecutive pixels for 1-D interpolation at a point between
+// the second and the third of them, in fixed point with INTERP_WEIGHT_SHIFT
+// fractional bits.
+#define INTERP_WEIGHT_SHIFT 12
+#define INTERP_WEIGHT_ONE (1 << INTERP_WEIGHT_SHIFT)
+
+typedef struct {
+  int32_t tap[4];
+} TapWeights;
+
+TapWeights tap_weights(int64_t fraction, Interpolation function);
+void interpolate_span(const Pixel *taps, TapWeights weights, int32_t count,
+                      Pixel *out);
+void interpolate_across(const Pixel *const rows[4], const TapWeights weights[],
+                        int32_t count, Pixel *out);
@@ -11,6 +11,7 @@
 #include "imageprocess/pixel.h"
 #include "imageprocess/primitives.h"
 #include "lib/logging.h"
+#include "lib/math_util.h"
 
 bool validate_mask_detection_parameters(
     MaskDetectionParameters *params, Direction scan_direction,
@@ -291,9 +292,27 @@ void align_mask(Image image, const Rectangle inside_area,
   free_image(&newimage);
 }
 
+static int compare_left_edges(const void *a, const void *b) {
+  const Rectangle *first = a, *second = b;
+
+  return (first->vertex[0].x > second->vertex[0].x) -
+         (first->vertex[0].x < second->vertex[0].x);
+}
+
+static int compare_coordinates(const void *a, const void *b) {
+  const int32_t *first = a, *second = b;
+
+  return (*first > *second) - (*first < *second);
+}
+
 /**
  * Permanently applies image masks. Each pixel which is not covered by at least
  * one mask is set to maskColor.
+ *
+ * The image is split into bands of rows at the top and bottom edges of the
+ * masks, so that each mask covers either all or none of the rows of a band.
+ * The union of the masks covering a band is then computed once, and the spans
+ * between them are filled for all the rows of the band at once.
  */
 void apply_masks(Image image, const Rectangle masks[], size_t masks_count,
                  Pixel color) {
@@ -301,12 +320,55 @@ void apply_masks(Image image, const Rectangle masks[], size_t masks_count,
     return;
   }
 
-  Rectangle image_area = full_image(image);
+  RectangleSize image_size = size_of_image(image);
+  Rectangle visible[masks_count];
+  int32_t edges[2 * masks_count + 2];
+  size_t visible_count = 0, edges_count = 0;
+
+  edges[edges_count++] = 0;
+  edges[edges_count++] = image_size.height;
+  for (size_t n = 0; n < masks_count; n++) {
+    // Masks outside of the image end up inverted once clipped.
+    Rectangle mask = clip_rectangle(image, masks[n]);
+    if (mask.vertex[0].x > mask.vertex[1].x ||
+        mask.vertex[0].y > mask.vertex[1].y) {
+      continue;
+    }
+
+    visible[visible_count++] = mask;
+    edges[edges_count++] = mask.vertex[0].y;
+    edges[edges_count++] = mask.vertex[1].y + 1;
+  }
+
+  qsort(visible, visible_count, sizeof(Rectangle), compare_left_edges);
+  qsort(edges, edges_count, sizeof(int32_t), compare_coordinates);
+
+  for (size_t e = 0; e + 1 < edges_count; e++) {
+    const int32_t top = edges[e], bottom = edges[e + 1] - 1;
+    if (top > bottom) {
+      continue;
+    }
+
+    // First column of the band that is not known to be covered yet.
+    int32_t x = 0;
+    for (size_t n = 0; n < visible_count; n++) {
+      const Rectangle mask = visible[n];
+      if (mask.vertex[0].y > top || mask.vertex[1].y < bottom) {
+        continue;
+      }
+
+      if (mask.vertex[0].x > x) {
+        wipe_rectangle(image,
+                       (Rectangle){{{x, top}, {mask.vertex[0].x - 1, bottom}}},
+                       color);
+      }
+      x = max(x, mask.vertex[1].x + 1);
+    }
 
-  scan_rectangle(image_area) {
-    Point p = {x, y};
-    if (!point_in_rectangles_any(p, masks_count, masks)) {
-      set_pixel(image, p, color);
+    if (x < image_size.width) {
+      wipe_rectangle(image,
+                     (Rectangle){{{x, top}, {image_size.width - 1, bottom}}},
+                     color);
     }
   }
 }
@@ -317,7 +379,7 @@ void apply_masks(Image image, const Rectangle masks[], size_t masks_count,
  */
 void apply_wipes(Image image, Wipes wipes, Pixel color) {
   for (size_t i = 0; i < wipes.count; i++) {
-    scan_rectangle(wipes.areas[i]) { set_pixel(image, (Point){x, y}, color); }
+    wipe_rectangle(image, wipes.areas[i], color);
 
     verboseLog(VERBOSE_MORE,
                "wipe [%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "]\n",
@@ -386,7 +448,7 @@ static uint32_t detect_border_edge(Image image, const Rectangle outside_mask,
                                    int32_t threshold) {
   Rectangle area = outside_mask;
   RectangleSize mask_size = size_of_rectangle(outside_mask);
-  int32_t max_step;
+  uint32_t max_step;
 
   if (step.vertical == 0) { // horizontal detection
     if (step.horizontal > 0) {
@@ -406,9 +468,9 @@ static uint32_t detect_border_edge(Image image, const Rectangle outside_mask,
 
   uint32_t result = 0;
   while (result < max_step) {
-    uint32_t cnt = count_pixels_within_brightness(
+    uint64_t cnt = count_pixels_within_brightness(
         image, area, 0, image.abs_black_threshold, false);
-    if (cnt >= threshold) {
+    if (cnt >= (uint32_t)threshold) {
       return result; // border has been found: regular exit here
     }
 
@@ -3,62 +3,38 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <libavutil/avutil.h>
 #include <libavutil/frame.h>
 #include <libavutil/pixfmt.h>
 
+#include "imageprocess/integral.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/pixel_formats.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
 
-static inline uint8_t pixel_grayscale(Pixel pixel) {
-  return (pixel.r + pixel.g + pixel.b) / 3;
-}
-
 static Pixel get_pixel_components(Image image, Point coords) {
-  uint8_t *pix;
-
   if (!point_in_rectangle(coords, full_image(image))) {
     return PIXEL_WHITE;
   }
 
+  const uint8_t *row = get_pixel_row(image, coords.y);
+
+#define GET_PIXEL_CASE(name, format)                                           \
+  case format:                                                                 \
+    return name##_get(row, coords.x);
+
   switch (image.frame->format) {
-  case AV_PIX_FMT_GRAY8:
-    pix =
-        image.frame->data[0] + (coords.y * image.frame->linesize[0] + coords.x);
-    return (Pixel){*pix, *pix, *pix};
-  case AV_PIX_FMT_Y400A:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x * 2);
-    return (Pixel){*pix, *pix, *pix};
-  case AV_PIX_FMT_RGB24:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x * 3);
-    return (Pixel){
-        .r = pix[0],
-        .g = pix[1],
-        .b = pix[2],
-    };
-  case AV_PIX_FMT_MONOWHITE:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x / 8);
-    if (*pix & (128 >> (coords.x % 8)))
-      return PIXEL_BLACK;
-    else
-      return PIXEL_WHITE;
-  case AV_PIX_FMT_MONOBLACK:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x / 8);
-    if (*pix & (128 >> (coords.x % 8)))
-      return PIXEL_WHITE;
-    else
-      return PIXEL_BLACK;
+    FOR_EACH_PIXEL_FORMAT(GET_PIXEL_CASE)
   default:
     errOutput("unknown pixel format.");
-    return PIXEL_WHITE; // technically unreachable
   }
+
+#undef GET_PIXEL_CASE
 }
 
 Pixel pixel_from_value(uint32_t value) {
@@ -126,48 +102,277 @@ uint8_t get_pixel_darkness_inverse(Image image, Point coords) {
 }
 
 /**
- * Sets the color/grayscale value of a single pixel.
+ * Returns a pointer to the first byte of a row of pixels, in the native
+ * format of the image, or NULL if the row is outside the image.
  */
-void set_pixel(Image image, Point coords, Pixel pixel) {
-  uint8_t *pix;
+const uint8_t *get_pixel_row(Image image, int32_t y) {
+  if (y < 0 || y >= image.frame->height) {
+    return NULL;
+  }
 
-  if (!point_in_rectangle(coords, full_image(image))) {
-    return;
+  return image.frame->data[0] + (ptrdiff_t)y * image.frame->linesize[0];
+}
+
+/**
+ * Same as get_pixel_row(), for a row that is about to be modified. This
+ * invalidates the integral images cached for the image, so it must be used
+ * for every write to the pixel data.
+ */
+uint8_t *get_writable_pixel_row(Image image, int32_t y) {
+  if (y < 0 || y >= image.frame->height) {
+    return NULL;
+  }
+
+  invalidate_integral_images(image);
+  return image.frame->data[0] + (ptrdiff_t)y * image.frame->linesize[0];
+}
+
+/**
+ * Clips the span of count pixels starting at start to the visible part of the
+ * image.
+ *
+ * @return the number of pixels to skip from the start of the span, and sets
+ * *visible to the number of pixels that are within the image.
+ */
+static int32_t clip_span(Image image, Point start, int32_t count,
+                         int32_t *visible) {
+  if (start.y < 0 || start.y >= image.frame->height || count <= 0) {
+    *visible = 0;
+    return 0;
+  }
+
+  int32_t first = max(start.x, 0);
+  int32_t last = min(start.x + count, image.frame->width);
+
+  *visible = max(last - first, 0);
+  return min(first - start.x, count);
+}
+
+typedef enum {
+  CHANNEL_GRAYSCALE,
+  CHANNEL_LIGHTNESS,
+  CHANNEL_DARKNESS_INVERSE,
+} ChannelReduction;
+
+#define DEFINE_SPAN_KERNELS(name, format)                                      \
+  static void name##_get_pixels(const uint8_t *row, int32_t x, int32_t count,  \
+                                Pixel *out) {                                  \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      out[i] = name##_get(row, x + i);                                         \
+    }                                                                          \
+  }                                                                            \
+  static void name##_get_channel(const uint8_t *row, int32_t x, int32_t count, \
+                                 uint8_t *out, ChannelReduction reduction) {   \
+    switch (reduction) {                                                       \
+    case CHANNEL_GRAYSCALE:                                                    \
+      for (int32_t i = 0; i < count; i++) {                                    \
+        out[i] = name##_grayscale(row, x + i);                                 \
+      }                                                                        \
+      break;                                                                   \
+    case CHANNEL_LIGHTNESS:                                                    \
+      for (int32_t i = 0; i < count; i++) {                                    \
+        out[i] = name##_lightness(row, x + i);                                 \
+      }                                                                        \
+      break;                                                                   \
+    case CHANNEL_DARKNESS_INVERSE:                                             \
+      for (int32_t i = 0; i < count; i++) {                                    \
+        out[i] = name##_darkness_inverse(row, x + i);                          \
+      }                                                                        \
+      break;                                                                   \
+    }                                                                          \
+  }                                                                            \
+  static void name##_set_pixels(uint8_t *row, int32_t x, int32_t count,        \
+                                const Pixel *in,                               \
+                                uint8_t abs_black_threshold) {                 \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      name##_set(row, x + i, in[i], abs_black_threshold);                      \
+    }                                                                          \
+  }
+
+FOR_EACH_PIXEL_FORMAT(DEFINE_SPAN_KERNELS)
+
+#undef DEFINE_SPAN_KERNELS
+
+/**
+ * Returns the function reading a row of pixels of the image's format, without
+ * bounds checks, so that callers can dispatch on the format once.
+ */
+PixelRowReader get_pixel_row_reader(Image image) {
+#define ROW_READER_CASE(name, format)                                          \
+  case format:                                                                 \
+    return name##_get_pixels;
+
+  switch (image.frame->format) {
+    FOR_EACH_PIXEL_FORMAT(ROW_READER_CASE)
+  default:
+    errOutput("unknown pixel format.");
   }
 
-  bool pixel_black = pixel_grayscale(pixel) < image.abs_black_threshold;
+#undef ROW_READER_CASE
+}
+
+/**
+ * Returns the function writing a row of pixels in the image's format, without
+ * bounds checks, so that callers can dispatch on the format once.
+ */
+PixelRowWriter get_pixel_row_writer(Image image) {
+#define ROW_WRITER_CASE(name, format)                                          \
+  case format:                                                                 \
+    return name##_set_pixels;
 
   switch (image.frame->format) {
-  case AV_PIX_FMT_GRAY8:
-    pix =
-        image.frame->data[0] + (coords.y * image.frame->linesize[0] + coords.x);
-    *pix = pixel_grayscale(pixel);
+    FOR_EACH_PIXEL_FORMAT(ROW_WRITER_CASE)
+  default:
+    errOutput("unknown pixel format.");
+  }
+
+#undef ROW_WRITER_CASE
+}
+
+/**
+ * Reads a span of count horizontally consecutive pixels, starting at start,
+ * into out. Pixels outside of the image are returned as white, as with
+ * get_pixel().
+ */
+void get_pixel_span(Image image, Point start, int32_t count, Pixel *out) {
+  int32_t visible;
+  int32_t skip = clip_span(image, start, count, &visible);
+
+  for (int32_t i = 0; i < skip; i++) {
+    out[i] = PIXEL_WHITE;
+  }
+  for (int32_t i = skip + visible; i < count; i++) {
+    out[i] = PIXEL_WHITE;
+  }
+  if (visible == 0) {
+    return;
+  }
+
+  const uint8_t *row = get_pixel_row(image, start.y);
+
+#define GET_PIXELS_CASE(name, format)                                          \
+  case format:                                                                 \
+    name##_get_pixels(row, start.x + skip, visible, out + skip);               \
     break;
-  case AV_PIX_FMT_Y400A:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x * 2);
-    pix[0] = pixel_grayscale(pixel);
-    pix[1] = 0xFF; // no alpha.
+
+  switch (image.frame->format) {
+    FOR_EACH_PIXEL_FORMAT(GET_PIXELS_CASE)
+  default:
+    errOutput("unknown pixel format.");
+  }
+
+#undef GET_PIXELS_CASE
+}
+
+/**
+ * Reads a span of pixels reduced to a single 8-bit channel. Only color images
+ * need the reduction, all other formats have a single brightness value.
+ */
+static void get_channel_span(Image image, Point start, int32_t count,
+                             uint8_t *out, ChannelReduction reduction) {
+  if (count <= 0) {
+    return;
+  }
+
+  int32_t visible;
+  int32_t skip = clip_span(image, start, count, &visible);
+
+  memset(out, UINT8_MAX, skip);
+  memset(out + skip + visible, UINT8_MAX, count - skip - visible);
+  if (visible == 0) {
+    return;
+  }
+
+  const uint8_t *row = get_pixel_row(image, start.y);
+
+#define GET_CHANNEL_CASE(name, format)                                         \
+  case format:                                                                 \
+    name##_get_channel(row, start.x + skip, visible, out + skip, reduction);   \
     break;
-  case AV_PIX_FMT_RGB24:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x * 3);
-    pix[0] = pixel.r;
-    pix[1] = pixel.g;
-    pix[2] = pixel.b;
+
+  switch (image.frame->format) {
+    FOR_EACH_PIXEL_FORMAT(GET_CHANNEL_CASE)
+  default:
+    errOutput("unknown pixel format.");
+  }
+
+#undef GET_CHANNEL_CASE
+}
+
+/**
+ * Span equivalent of get_pixel_grayscale().
+ */
+void get_grayscale_span(Image image, Point start, int32_t count,
+                        uint8_t *out) {
+  get_channel_span(image, start, count, out, CHANNEL_GRAYSCALE);
+}
+
+/**
+ * Span equivalent of get_pixel_lightness().
+ */
+void get_lightness_span(Image image, Point start, int32_t count,
+                        uint8_t *out) {
+  get_channel_span(image, start, count, out, CHANNEL_LIGHTNESS);
+}
+
+/**
+ * Span equivalent of get_pixel_darkness_inverse().
+ */
+void get_darkness_inverse_span(Image image, Point start, int32_t count,
+                               uint8_t *out) {
+  get_channel_span(image, start, count, out, CHANNEL_DARKNESS_INVERSE);
+}
+
+/**
+ * Writes a span of count horizontally consecutive pixels, starting at start.
+ * Pixels that fall outside of the image are ignored, as with set_pixel().
+ */
+void set_pixel_span(Image image, Point start, int32_t count,
+                    const Pixel *in) {
+  int32_t visible;
+  int32_t skip = clip_span(image, start, count, &visible);
+
+  if (visible == 0) {
+    return;
+  }
+
+  uint8_t *row = get_writable_pixel_row(image, start.y);
+
+#define SET_PIXELS_CASE(name, format)                                          \
+  case format:                                                                 \
+    name##_set_pixels(row, start.x + skip, visible, in + skip,                 \
+                      image.abs_black_threshold);                              \
     break;
-  case AV_PIX_FMT_MONOWHITE:
-    pixel_black = !pixel_black; // reverse compared to following case
-  case AV_PIX_FMT_MONOBLACK:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x / 8);
-    if (!pixel_black) {
-      *pix = *pix | (128 >> (coords.x % 8));
-    } else if (pixel_black) {
-      *pix = *pix & ~(128 >> (coords.x % 8));
-    }
+
+  switch (image.frame->format) {
+    FOR_EACH_PIXEL_FORMAT(SET_PIXELS_CASE)
+  default:
+    errOutput("unknown pixel format.");
+  }
+
+#undef SET_PIXELS_CASE
+}
+
+/**
+ * Sets the color/grayscale value of a single pixel.
+ */
+void set_pixel(Image image, Point coords, Pixel pixel) {
+  if (!point_in_rectangle(coords, full_image(image))) {
+    return;
+  }
+
+  uint8_t *row = get_writable_pixel_row(image, coords.y);
+
+#define SET_PIXEL_CASE(name, format)                                           \
+  case format:                                                                 \
+    name##_set(row, coords.x, pixel, image.abs_black_threshold);               \
     break;
+
+  switch (image.frame->format) {
+    FOR_EACH_PIXEL_FORMAT(SET_PIXEL_CASE)
   default:
     errOutput("unknown pixel format.");
   }
+
+#undef SET_PIXEL_CASE
 }
@@ -17,3 +17,20 @@ uint8_t get_pixel_grayscale(Image image, Point coords);
 uint8_t get_pixel_lightness(Image image, Point coords);
 uint8_t get_pixel_darkness_inverse(Image image, Point coords);
 void set_pixel(Image image, Point coords, Pixel pixel);
+
+const uint8_t *get_pixel_row(Image image, int32_t y);
+uint8_t *get_writable_pixel_row(Image image, int32_t y);
+
+typedef void (*PixelRowReader)(const uint8_t *row, int32_t x, int32_t count,
+                               Pixel *out);
+typedef void (*PixelRowWriter)(uint8_t *row, int32_t x, int32_t count,
+                               const Pixel *in, uint8_t abs_black_threshold);
+PixelRowReader get_pixel_row_reader(Image image);
+PixelRowWriter get_pixel_row_writer(Image image);
+
+void get_pixel_span(Image image, Point start, int32_t count, Pixel *out);
+void get_grayscale_span(Image image, Point start, int32_t count, uint8_t *out);
+void get_lightness_span(Image image, Point start, int32_t count, uint8_t *out);
+void get_darkness_inverse_span(Image image, Point start, int32_t count,
+                               uint8_t *out);
+void set_pixel_span(Image image, Point start, int32_t count, const Pixel *in);
@@ -0,0 +1,179 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/primitives.h"
+
+/**
+ * Per-format pixel accessors.
+ *
+ * Each of the pixel formats supported by unpaper has a set of inline accessors
+ * that operate on a row pointer (as returned by get_pixel_row()) and a column,
+ * without any bounds check:
+ *
+ *   Pixel <name>_get(const uint8_t *row, int32_t x);
+ *   uint8_t <name>_grayscale(const uint8_t *row, int32_t x);
+ *   uint8_t <name>_lightness(const uint8_t *row, int32_t x);
+ *   uint8_t <name>_darkness_inverse(const uint8_t *row, int32_t x);
+ *   void <name>_set(uint8_t *row, int32_t x, Pixel pixel,
+ *                   uint8_t abs_black_threshold);
+ *
+ * FOR_EACH_PIXEL_FORMAT() expands X(name, format) for each of them, and is
+ * used to generate one copy of a kernel per format, as well as the switch
+ * statement that dispatches to the right copy once per call. Since the format
+ * is fixed within each generated copy, the inner loops have no branches on
+ * the format and can be vectorized by the compiler.
+ */
+#define FOR_EACH_PIXEL_FORMAT(X)                                               \
+  FOR_EACH_BYTE_PIXEL_FORMAT(X)                                                \
+  FOR_EACH_BILEVEL_PIXEL_FORMAT(X)
+
+// Formats storing each pixel in one or more whole bytes.
+#define FOR_EACH_BYTE_PIXEL_FORMAT(X)                                          \
+  X(gray8, AV_PIX_FMT_GRAY8)                                                   \
+  X(y400a, AV_PIX_FMT_Y400A)                                                   \
+  X(rgb24, AV_PIX_FMT_RGB24)
+
+// Formats packing eight pixels per byte, most significant bit first. These
+// have two more accessors, mapping pixels to bit values and back:
+//
+//   bool <name>_bit(Pixel pixel, uint8_t abs_black_threshold);
+//   uint8_t <name>_bit_grayscale(bool bit);
+#define FOR_EACH_BILEVEL_PIXEL_FORMAT(X)                                       \
+  X(monowhite, AV_PIX_FMT_MONOWHITE)                                           \
+  X(monoblack, AV_PIX_FMT_MONOBLACK)
+
+static inline uint8_t pixel_grayscale(Pixel pixel) {
+  return (pixel.r + pixel.g + pixel.b) / 3;
+}
+
+static inline bool mono_bit(const uint8_t *row, int32_t x) {
+  return row[x / 8] & (128 >> (x % 8));
+}
+
+static inline void set_mono_bit(uint8_t *row, int32_t x, bool value) {
+  if (value) {
+    row[x / 8] |= (128 >> (x % 8));
+  } else {
+    row[x / 8] &= ~(128 >> (x % 8));
+  }
+}
+
+// Formats with a single channel have the same grayscale, lightness and
+// darkness-inverse values.
+#define DEFINE_SINGLE_CHANNEL_REDUCTIONS(name)                                 \
+  static inline uint8_t name##_lightness(const uint8_t *row, int32_t x) {      \
+    return name##_grayscale(row, x);                                           \
+  }                                                                            \
+  static inline uint8_t name##_darkness_inverse(const uint8_t *row,            \
+                                                int32_t x) {                   \
+    return name##_grayscale(row, x);                                           \
+  }
+
+static inline uint8_t gray8_grayscale(const uint8_t *row, int32_t x) {
+  return row[x];
+}
+
+static inline Pixel gray8_get(const uint8_t *row, int32_t x) {
+  return (Pixel){row[x], row[x], row[x]};
+}
+
+static inline void gray8_set(uint8_t *row, int32_t x, Pixel pixel,
+                             uint8_t abs_black_threshold) {
+  (void)abs_black_threshold;
+  row[x] = pixel_grayscale(pixel);
+}
+
+DEFINE_SINGLE_CHANNEL_REDUCTIONS(gray8)
+
+static inline uint8_t y400a_grayscale(const uint8_t *row, int32_t x) {
+  return row[x * 2];
+}
+
+static inline Pixel y400a_get(const uint8_t *row, int32_t x) {
+  return (Pixel){row[x * 2], row[x * 2], row[x * 2]};
+}
+
+static inline void y400a_set(uint8_t *row, int32_t x, Pixel pixel,
+                             uint8_t abs_black_threshold) {
+  (void)abs_black_threshold;
+  row[x * 2] = pixel_grayscale(pixel);
+  row[x * 2 + 1] = 0xFF; // no alpha.
+}
+
+DEFINE_SINGLE_CHANNEL_REDUCTIONS(y400a)
+
+static inline Pixel rgb24_get(const uint8_t *row, int32_t x) {
+  const uint8_t *pix = row + x * 3;
+  return (Pixel){pix[0], pix[1], pix[2]};
+}
+
+static inline uint8_t rgb24_grayscale(const uint8_t *row, int32_t x) {
+  const uint8_t *pix = row + x * 3;
+  return (pix[0] + pix[1] + pix[2]) / 3;
+}
+
+static inline uint8_t rgb24_lightness(const uint8_t *row, int32_t x) {
+  const uint8_t *pix = row + x * 3;
+  const uint8_t rg = pix[0] < pix[1] ? pix[0] : pix[1];
+  return rg < pix[2] ? rg : pix[2];
+}
+
+static inline uint8_t rgb24_darkness_inverse(const uint8_t *row, int32_t x) {
+  const uint8_t *pix = row + x * 3;
+  const uint8_t rg = pix[0] > pix[1] ? pix[0] : pix[1];
+  return rg > pix[2] ? rg : pix[2];
+}
+
+static inline void rgb24_set(uint8_t *row, int32_t x, Pixel pixel,
+                             uint8_t abs_black_threshold) {
+  (void)abs_black_threshold;
+  uint8_t *pix = row + x * 3;
+  pix[0] = pixel.r;
+  pix[1] = pixel.g;
+  pix[2] = pixel.b;
+}
+
+// In MONOWHITE images a set bit is a black pixel.
+static inline bool monowhite_bit(Pixel pixel, uint8_t abs_black_threshold) {
+  return pixel_grayscale(pixel) < abs_black_threshold;
+}
+
+static inline uint8_t monowhite_bit_grayscale(bool bit) {
+  return bit ? 0 : UINT8_MAX;
+}
+
+// In MONOBLACK images a set bit is a white pixel.
+static inline bool monoblack_bit(Pixel pixel, uint8_t abs_black_threshold) {
+  return pixel_grayscale(pixel) >= abs_black_threshold;
+}
+
+static inline uint8_t monoblack_bit_grayscale(bool bit) {
+  return bit ? UINT8_MAX : 0;
+}
+
+#define DEFINE_BILEVEL_ACCESSORS(name, format)                                 \
+  static inline uint8_t name##_grayscale(const uint8_t *row, int32_t x) {      \
+    return name##_bit_grayscale(mono_bit(row, x));                             \
+  }                                                                            \
+  static inline Pixel name##_get(const uint8_t *row, int32_t x) {              \
+    const uint8_t value = name##_grayscale(row, x);                            \
+    return (Pixel){value, value, value};                                       \
+  }                                                                            \
+  static inline void name##_set(uint8_t *row, int32_t x, Pixel pixel,          \
+                                uint8_t abs_black_threshold) {                 \
+    set_mono_bit(row, x, name##_bit(pixel, abs_black_threshold));              \
+  }                                                                            \
+  DEFINE_SINGLE_CHANNEL_REDUCTIONS(name)
+
+FOR_EACH_BILEVEL_PIXEL_FORMAT(DEFINE_BILEVEL_ACCESSORS)
+
+#undef DEFINE_BILEVEL_ACCESSORS
+#undef DEFINE_SINGLE_CHANNEL_REDUCTIONS
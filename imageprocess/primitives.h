@@ -82,6 +82,20 @@ typedef struct {
   for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++)               \
     for (int32_t x = area.vertex[0].x; x <= area.vertex[1].x; x++)
 
+static inline int32_t span_length(int32_t x, int32_t last_x,
+                                  int32_t span_size) {
+  return (last_x - x + 1) < span_size ? (last_x - x + 1) : span_size;
+}
+
+// Scans a rectangle one row at a time, in horizontal spans of at most
+// span_size pixels, each starting at (x, y) and covering length pixels.
+#define scan_rectangle_spans(area, span_size)                                  \
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++)               \
+    for (int32_t x = area.vertex[0].x, length;                                 \
+         length = span_length(x, area.vertex[1].x, span_size),                 \
+                 x <= area.vertex[1].x;                                        \
+         x += span_size)
+
 Rectangle rectangle_from_size(Point origin, RectangleSize size);
 RectangleSize size_of_rectangle(Rectangle rect);
 Rectangle normalize_rectangle(Rectangle input);
@@ -0,0 +1,363 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libavutil/cpu.h>
+#include <libavutil/pixfmt.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_REDUCTIONS 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON_REDUCTIONS 1
+#endif
+
+#include "imageprocess/pixel_formats.h"
+#include "imageprocess/reductions.h"
+
+/**
+ * Row reductions that the rectangle statistics of blit.c are built on.
+ *
+ * Every byte pixel format has a scalar implementation, generated from its
+ * inline accessors, which is the reference for the others. The most common
+ * formats also have SSE2, AVX2 or NEON versions, selected the first time the
+ * reductions are requested, according to the features of the CPU. They all
+ * return exactly the same results.
+ */
+
+#define DEFINE_SCALAR_REDUCTIONS(name, format)                                 \
+  static uint64_t name##_sum_grayscale(const uint8_t *row, int32_t x,          \
+                                       int32_t count) {                        \
+    uint64_t sum = 0;                                                          \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      sum += name##_grayscale(row, x + i);                                     \
+    }                                                                          \
+    return sum;                                                                \
+  }                                                                            \
+  static uint64_t name##_sum_lightness(const uint8_t *row, int32_t x,          \
+                                       int32_t count) {                        \
+    uint64_t sum = 0;                                                          \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      sum += name##_lightness(row, x + i);                                     \
+    }                                                                          \
+    return sum;                                                                \
+  }                                                                            \
+  static uint64_t name##_sum_darkness_inverse(const uint8_t *row, int32_t x,   \
+                                              int32_t count) {                 \
+    uint64_t sum = 0;                                                          \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      sum += name##_darkness_inverse(row, x + i);                              \
+    }                                                                          \
+    return sum;                                                                \
+  }                                                                            \
+  static uint64_t name##_count_within_brightness(                              \
+      const uint8_t *row, int32_t x, int32_t count, uint8_t min_brightness,    \
+      uint8_t max_brightness) {                                                \
+    uint64_t within = 0;                                                       \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      const uint8_t brightness = name##_grayscale(row, x + i);                 \
+      within += brightness >= min_brightness && brightness <= max_brightness;  \
+    }                                                                          \
+    return within;                                                             \
+  }                                                                            \
+  static RowReductions name##_reductions = {                                   \
+      .sum_grayscale = name##_sum_grayscale,                                   \
+      .sum_lightness = name##_sum_lightness,                                   \
+      .sum_darkness_inverse = name##_sum_darkness_inverse,                     \
+      .count_within_brightness = name##_count_within_brightness,               \
+  };
+
+FOR_EACH_BYTE_PIXEL_FORMAT(DEFINE_SCALAR_REDUCTIONS)
+
+#undef DEFINE_SCALAR_REDUCTIONS
+
+#ifdef HAVE_X86_REDUCTIONS
+
+// The RGB kernels compare each byte with the two following ones, so that the
+// bytes at the start of each pixel hold the minimum or maximum of its
+// channels, and only sum those. SSE2 handles 6 pixels per iteration, AVX2 11.
+#define SSE2_RGB_PIXELS 6
+#define AVX2_RGB_PIXELS 11
+
+__attribute__((target("sse2"))) static uint64_t
+sse2_add_lanes(__m128i sums) {
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, sums);
+  return lanes[0] + lanes[1];
+}
+
+__attribute__((target("sse2"))) static uint64_t
+sse2_gray8_sum(const uint8_t *row, int32_t x, int32_t count) {
+  const uint8_t *bytes = row + x;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sums = zero;
+  int32_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const __m128i values = _mm_loadu_si128((const __m128i *)(bytes + i));
+    sums = _mm_add_epi64(sums, _mm_sad_epu8(values, zero));
+  }
+
+  return sse2_add_lanes(sums) + gray8_sum_grayscale(bytes, i, count - i);
+}
+
+__attribute__((target("sse2"))) static uint64_t
+sse2_gray8_count_within_brightness(const uint8_t *row, int32_t x,
+                                   int32_t count, uint8_t min_brightness,
+                                   uint8_t max_brightness) {
+  const uint8_t *bytes = row + x;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi8(1);
+  const __m128i min = _mm_set1_epi8((char)min_brightness);
+  const __m128i max = _mm_set1_epi8((char)max_brightness);
+  __m128i counts = zero;
+  int32_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const __m128i values = _mm_loadu_si128((const __m128i *)(bytes + i));
+    const __m128i within =
+        _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(values, min), values),
+                      _mm_cmpeq_epi8(_mm_min_epu8(values, max), values));
+    counts = _mm_add_epi64(counts,
+                           _mm_sad_epu8(_mm_and_si128(within, ones), zero));
+  }
+
+  return sse2_add_lanes(counts) +
+         gray8_count_within_brightness(bytes, i, count - i, min_brightness,
+                                       max_brightness);
+}
+
+#define DEFINE_SSE2_RGB24_SUM(name, reduce, scalar)                            \
+  __attribute__((target("sse2"))) static uint64_t sse2_rgb24_sum_##name(       \
+      const uint8_t *row, int32_t x, int32_t count) {                          \
+    const uint8_t *pixels = row + x * 3;                                       \
+    const __m128i zero = _mm_setzero_si128();                                  \
+    const __m128i first_bytes = _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0,    \
+                                              -1, 0, 0, -1, 0, 0, -1);         \
+    __m128i sums = zero;                                                       \
+    int32_t i = 0;                                                             \
+                                                                               \
+    for (; i + SSE2_RGB_PIXELS <= count; i += SSE2_RGB_PIXELS) {               \
+      const uint8_t *p = pixels + i * 3;                                       \
+      const __m128i reduced =                                                  \
+          reduce(_mm_loadu_si128((const __m128i *)p),                          \
+                 reduce(_mm_loadu_si128((const __m128i *)(p + 1)),             \
+                        _mm_loadu_si128((const __m128i *)(p + 2))));           \
+      sums = _mm_add_epi64(                                                    \
+          sums, _mm_sad_epu8(_mm_and_si128(reduced, first_bytes), zero));      \
+    }                                                                          \
+                                                                               \
+    return sse2_add_lanes(sums) + scalar(pixels, i, count - i);                \
+  }
+
+DEFINE_SSE2_RGB24_SUM(lightness, _mm_min_epu8, rgb24_sum_lightness)
+DEFINE_SSE2_RGB24_SUM(darkness_inverse, _mm_max_epu8,
+                      rgb24_sum_darkness_inverse)
+
+#undef DEFINE_SSE2_RGB24_SUM
+
+__attribute__((target("avx2"))) static uint64_t avx2_add_lanes(__m256i sums) {
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, sums);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2"))) static uint64_t
+avx2_gray8_sum(const uint8_t *row, int32_t x, int32_t count) {
+  const uint8_t *bytes = row + x;
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i sums = zero;
+  int32_t i = 0;
+
+  for (; i + 32 <= count; i += 32) {
+    const __m256i values = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    sums = _mm256_add_epi64(sums, _mm256_sad_epu8(values, zero));
+  }
+
+  return avx2_add_lanes(sums) + gray8_sum_grayscale(bytes, i, count - i);
+}
+
+__attribute__((target("avx2"))) static uint64_t
+avx2_gray8_count_within_brightness(const uint8_t *row, int32_t x,
+                                   int32_t count, uint8_t min_brightness,
+                                   uint8_t max_brightness) {
+  const uint8_t *bytes = row + x;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi8(1);
+  const __m256i min = _mm256_set1_epi8((char)min_brightness);
+  const __m256i max = _mm256_set1_epi8((char)max_brightness);
+  __m256i counts = zero;
+  int32_t i = 0;
+
+  for (; i + 32 <= count; i += 32) {
+    const __m256i values = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    const __m256i within = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_max_epu8(values, min), values),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(values, max), values));
+    counts = _mm256_add_epi64(
+        counts, _mm256_sad_epu8(_mm256_and_si256(within, ones), zero));
+  }
+
+  return avx2_add_lanes(counts) +
+         gray8_count_within_brightness(bytes, i, count - i, min_brightness,
+                                       max_brightness);
+}
+
+#define DEFINE_AVX2_RGB24_SUM(name, reduce, scalar)                            \
+  __attribute__((target("avx2"))) static uint64_t avx2_rgb24_sum_##name(       \
+      const uint8_t *row, int32_t x, int32_t count) {                          \
+    const uint8_t *pixels = row + x * 3;                                       \
+    const __m256i zero = _mm256_setzero_si256();                               \
+    const __m256i first_bytes = _mm256_setr_epi8(                              \
+        -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0,  \
+        -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0);                                  \
+    __m256i sums = zero;                                                       \
+    int32_t i = 0;                                                             \
+                                                                               \
+    /* The last load reads one byte past the pixels of the iteration. */       \
+    for (; (i + AVX2_RGB_PIXELS) * 3 + 1 <= count * 3;                         \
+         i += AVX2_RGB_PIXELS) {                                               \
+      const uint8_t *p = pixels + i * 3;                                       \
+      const __m256i reduced =                                                  \
+          reduce(_mm256_loadu_si256((const __m256i *)p),                       \
+                 reduce(_mm256_loadu_si256((const __m256i *)(p + 1)),          \
+                        _mm256_loadu_si256((const __m256i *)(p + 2))));        \
+      const __m256i selected = _mm256_and_si256(reduced, first_bytes);         \
+      sums = _mm256_add_epi64(sums, _mm256_sad_epu8(selected, zero));          \
+    }                                                                          \
+                                                                               \
+    return avx2_add_lanes(sums) + scalar(pixels, i, count - i);                \
+  }
+
+DEFINE_AVX2_RGB24_SUM(lightness, _mm256_min_epu8, rgb24_sum_lightness)
+DEFINE_AVX2_RGB24_SUM(darkness_inverse, _mm256_max_epu8,
+                      rgb24_sum_darkness_inverse)
+
+#undef DEFINE_AVX2_RGB24_SUM
+
+#endif // HAVE_X86_REDUCTIONS
+
+#ifdef HAVE_NEON_REDUCTIONS
+
+static uint64_t neon_gray8_sum(const uint8_t *row, int32_t x, int32_t count) {
+  const uint8_t *bytes = row + x;
+  uint64_t sum = 0;
+  int32_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    sum += vaddlvq_u8(vld1q_u8(bytes + i));
+  }
+
+  return sum + gray8_sum_grayscale(bytes, i, count - i);
+}
+
+static uint64_t neon_gray8_count_within_brightness(const uint8_t *row,
+                                                   int32_t x, int32_t count,
+                                                   uint8_t min_brightness,
+                                                   uint8_t max_brightness) {
+  const uint8_t *bytes = row + x;
+  const uint8x16_t min = vdupq_n_u8(min_brightness);
+  const uint8x16_t max = vdupq_n_u8(max_brightness);
+  uint64_t within = 0;
+  int32_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const uint8x16_t values = vld1q_u8(bytes + i);
+    const uint8x16_t mask =
+        vandq_u8(vcgeq_u8(values, min), vcleq_u8(values, max));
+    within += vaddlvq_u8(vshrq_n_u8(mask, 7));
+  }
+
+  return within + gray8_count_within_brightness(bytes, i, count - i,
+                                                min_brightness, max_brightness);
+}
+
+#define DEFINE_NEON_RGB24_SUM(name, reduce, scalar)                            \
+  static uint64_t neon_rgb24_sum_##name(const uint8_t *row, int32_t x,         \
+                                        int32_t count) {                       \
+    const uint8_t *pixels = row + x * 3;                                       \
+    uint64_t sum = 0;                                                          \
+    int32_t i = 0;                                                             \
+                                                                               \
+    for (; i + 16 <= count; i += 16) {                                         \
+      const uint8x16x3_t channels = vld3q_u8(pixels + i * 3);                  \
+      sum += vaddlvq_u8(                                                       \
+          reduce(channels.val[0], reduce(channels.val[1], channels.val[2])));  \
+    }                                                                          \
+                                                                               \
+    return sum + scalar(pixels, i, count - i);                                 \
+  }
+
+DEFINE_NEON_RGB24_SUM(lightness, vminq_u8, rgb24_sum_lightness)
+DEFINE_NEON_RGB24_SUM(darkness_inverse, vmaxq_u8, rgb24_sum_darkness_inverse)
+
+#undef DEFINE_NEON_RGB24_SUM
+
+#endif // HAVE_NEON_REDUCTIONS
+
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static void select_row_reductions(void) {
+  const int flags = av_get_cpu_flags();
+
+#ifdef HAVE_X86_REDUCTIONS
+  if (flags & AV_CPU_FLAG_SSE2) {
+    gray8_reductions = (RowReductions){
+        .sum_grayscale = sse2_gray8_sum,
+        .sum_lightness = sse2_gray8_sum,
+        .sum_darkness_inverse = sse2_gray8_sum,
+        .count_within_brightness = sse2_gray8_count_within_brightness,
+    };
+    rgb24_reductions.sum_lightness = sse2_rgb24_sum_lightness;
+    rgb24_reductions.sum_darkness_inverse = sse2_rgb24_sum_darkness_inverse;
+  }
+  if (flags & AV_CPU_FLAG_AVX2) {
+    gray8_reductions = (RowReductions){
+        .sum_grayscale = avx2_gray8_sum,
+        .sum_lightness = avx2_gray8_sum,
+        .sum_darkness_inverse = avx2_gray8_sum,
+        .count_within_brightness = avx2_gray8_count_within_brightness,
+    };
+    rgb24_reductions.sum_lightness = avx2_rgb24_sum_lightness;
+    rgb24_reductions.sum_darkness_inverse = avx2_rgb24_sum_darkness_inverse;
+  }
+#elif defined(HAVE_NEON_REDUCTIONS)
+  if (flags & AV_CPU_FLAG_NEON) {
+    gray8_reductions = (RowReductions){
+        .sum_grayscale = neon_gray8_sum,
+        .sum_lightness = neon_gray8_sum,
+        .sum_darkness_inverse = neon_gray8_sum,
+        .count_within_brightness = neon_gray8_count_within_brightness,
+    };
+    rgb24_reductions.sum_lightness = neon_rgb24_sum_lightness;
+    rgb24_reductions.sum_darkness_inverse = neon_rgb24_sum_darkness_inverse;
+  }
+#else
+  (void)flags;
+#endif
+}
+
+/**
+ * Returns the row reductions for a byte pixel format, or NULL for the other
+ * formats.
+ */
+const RowReductions *get_row_reductions(enum AVPixelFormat format) {
+  pthread_once(&select_once, select_row_reductions);
+
+#define REDUCTIONS_CASE(name, format)                                          \
+  case format:                                                                 \
+    return &name##_reductions;
+
+  switch (format) {
+    FOR_EACH_BYTE_PIXEL_FORMAT(REDUCTIONS_CASE)
+  default:
+    return NULL;
+  }
+
+#undef REDUCTIONS_CASE
+}
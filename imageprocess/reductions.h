@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdint.h>
+
+#include <libavutil/pixfmt.h>
+
+// Reductions over count pixels of a row (as returned by get_pixel_row()),
+// starting at column x.
+typedef uint64_t (*RowSum)(const uint8_t *row, int32_t x, int32_t count);
+typedef uint64_t (*RowCount)(const uint8_t *row, int32_t x, int32_t count,
+                             uint8_t min_brightness, uint8_t max_brightness);
+
+typedef struct {
+  RowSum sum_grayscale;
+  RowSum sum_lightness;
+  RowSum sum_darkness_inverse;
+  RowCount count_within_brightness;
+} RowReductions;
+
+const RowReductions *get_row_reductions(enum AVPixelFormat format);
@@ -0,0 +1,361 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <libavutil/common.h>
+
+#include "imageprocess/pixel.h"
+#include "imageprocess/resample.h"
+#include "lib/logging.h"
+#include "lib/math_util.h"
+#include "lib/parallel.h"
+
+/**
+ * Separable resampling of images, for stretching and resizing the sheets.
+ *
+ * An image is resampled in two passes: its rows are resampled to the target
+ * width first, then the columns of the result to the target height. Each pass
+ * follows a plan, that lists for every pixel of a target row (or column) the
+ * run of source pixels it mixes, and their weights.
+ *
+ * When enlarging, the weights are those that interpolate() uses at the same
+ * source coordinates, so cubic and nearest neighbour interpolation give exactly
+ * the same result as interpolating each target pixel in 2-D. Linear
+ * interpolation deliberately does not: interpolate() falls back to the nearest
+ * source pixel for target pixels on a source row or column, while each pass
+ * here still interpolates along its own direction. When shrinking with linear
+ * or cubic interpolation, each target pixel averages the area of the source
+ * that it covers instead, rather than sampling single points and losing the
+ * thin lines between them.
+ *
+ * The plans only depend on the lengths and the interpolation, so they are
+ * cached: for a batch of sheets of the same size, they are built once.
+ */
+
+// Number of rows resampled by each job run in parallel.
+#define RESAMPLE_BAND_HEIGHT 32
+
+// Maximum number of plans kept in the cache.
+#define MAX_RESAMPLE_PLANS 8
+
+typedef struct {
+  int32_t first;  // first source pixel mixed
+  int32_t count;  // number of source pixels mixed
+  size_t weights; // index of their weights in the plan
+} ResampleTaps;
+
+typedef struct {
+  int32_t source_length;
+  int32_t target_length;
+  Interpolation interpolation;
+  // Range of the source pixels read by any target pixel, which may extend
+  // past the source, where pixels are white.
+  int32_t first;
+  int32_t last;
+  ResampleTaps *taps;
+  int32_t *weights;
+} ResamplePlan;
+
+/**
+ * Cache of the plans, keyed by their lengths and interpolation. When all the
+ * slots are taken, the plan that was used least recently is freed.
+ *
+ * The cache is not thread-safe: images are only resampled from the main
+ * thread.
+ */
+static struct {
+  ResamplePlan *plan;
+  uint64_t last_used;
+} resample_plans[MAX_RESAMPLE_PLANS];
+
+static uint64_t resample_plans_clock = 0;
+
+static void free_plan(ResamplePlan *plan) {
+  if (plan != NULL) {
+    free(plan->taps);
+    free(plan->weights);
+    free(plan);
+  }
+}
+
+// Makes the weights of a run of taps add up to one, by adding the rounding
+// errors to the largest of them.
+static void normalize_weights(int32_t *weights, int32_t count) {
+  int32_t sum = 0;
+  int32_t largest = 0;
+
+  for (int32_t i = 0; i < count; i++) {
+    sum += weights[i];
+    if (weights[i] > weights[largest]) {
+      largest = i;
+    }
+  }
+  weights[largest] += INTERP_WEIGHT_ONE - sum;
+}
+
+/**
+ * Sets the taps of target pixel t to the source pixels that it covers, each
+ * weighted by the part of it that is covered.
+ */
+static int32_t plan_area_taps(const ResamplePlan *plan, int32_t t,
+                              int32_t *weights, int32_t *first) {
+  const double ratio = (double)plan->source_length / plan->target_length;
+  const double start = t * ratio;
+  const double end = min((t + 1) * ratio, (double)plan->source_length);
+  int32_t count = 0;
+
+  *first = (int32_t)floor(start);
+  for (int32_t s = *first; s < end; s++) {
+    const double covered = min(end, s + 1.0) - max(start, (double)s);
+    weights[count++] = (int32_t)lround(covered / ratio * INTERP_WEIGHT_ONE);
+  }
+
+  normalize_weights(weights, count);
+  return count;
+}
+
+/**
+ * Sets the taps of target pixel t to the source pixels that interpolate()
+ * mixes along one dimension, at the same source coordinate.
+ */
+static int32_t plan_point_taps(const ResamplePlan *plan, int32_t t,
+                               int32_t *weights, int32_t *first) {
+  const float ratio = (float)plan->source_length / (float)plan->target_length;
+  const int64_t coordinate = fixed_from_float(t * ratio);
+  const int32_t whole = fixed_floor(coordinate);
+  const int64_t fraction = coordinate - whole * FIXED_POINT_ONE;
+  const TapWeights taps = tap_weights(fraction, plan->interpolation);
+
+  switch (plan->interpolation) {
+  case INTERP_NN:
+    *first = whole + (fraction >= FIXED_POINT_HALF);
+    weights[0] = INTERP_WEIGHT_ONE;
+    return 1;
+  case INTERP_LINEAR:
+    // On a source pixel, or with no pixel after it, the pixel is taken as is.
+    *first = whole;
+    if (fraction == 0 || whole + 1 >= plan->source_length) {
+      weights[0] = INTERP_WEIGHT_ONE;
+      return 1;
+    }
+    weights[0] = taps.tap[1];
+    weights[1] = taps.tap[2];
+    return 2;
+  case INTERP_CUBIC:
+  default:
+    *first = whole - 1;
+    for (int i = 0; i < 4; i++) {
+      weights[i] = taps.tap[i];
+    }
+    return 4;
+  }
+}
+
+static ResamplePlan *create_plan(int32_t source_length, int32_t target_length,
+                                 Interpolation interpolation) {
+  const bool shrink =
+      source_length > target_length && interpolation != INTERP_NN;
+  const int32_t max_taps = shrink ? source_length / target_length + 2 : 4;
+
+  ResamplePlan *plan = malloc(sizeof(ResamplePlan));
+  if (plan == NULL) {
+    errOutput("unable to allocate resample plan.");
+  }
+  *plan = (ResamplePlan){
+      .source_length = source_length,
+      .target_length = target_length,
+      .interpolation = interpolation,
+      .first = INT32_MAX,
+      .last = INT32_MIN,
+      .taps = malloc(target_length * sizeof(ResampleTaps)),
+      .weights = malloc((size_t)target_length * max_taps * sizeof(int32_t)),
+  };
+  if (plan->taps == NULL || plan->weights == NULL) {
+    errOutput("unable to allocate resample plan.");
+  }
+
+  size_t weights = 0;
+  for (int32_t t = 0; t < target_length; t++) {
+    ResampleTaps *taps = &plan->taps[t];
+
+    taps->weights = weights;
+    taps->count = shrink ? plan_area_taps(plan, t, &plan->weights[weights],
+                                          &taps->first)
+                         : plan_point_taps(plan, t, &plan->weights[weights],
+                                           &taps->first);
+    weights += taps->count;
+
+    plan->first = min(plan->first, taps->first);
+    plan->last = max(plan->last, taps->first + taps->count - 1);
+  }
+
+  return plan;
+}
+
+static const ResamplePlan *get_plan(int32_t source_length,
+                                    int32_t target_length,
+                                    Interpolation interpolation) {
+  size_t slot = 0;
+
+  for (size_t i = 0; i < MAX_RESAMPLE_PLANS; i++) {
+    const ResamplePlan *plan = resample_plans[i].plan;
+    if (plan != NULL && plan->source_length == source_length &&
+        plan->target_length == target_length &&
+        plan->interpolation == interpolation) {
+      resample_plans[i].last_used = ++resample_plans_clock;
+      return plan;
+    }
+    if (resample_plans[i].last_used < resample_plans[slot].last_used) {
+      slot = i;
+    }
+  }
+
+  free_plan(resample_plans[slot].plan);
+  resample_plans[slot].plan =
+      create_plan(source_length, target_length, interpolation);
+  resample_plans[slot].last_used = ++resample_plans_clock;
+  return resample_plans[slot].plan;
+}
+
+void free_resample_plans(void) {
+  for (size_t i = 0; i < MAX_RESAMPLE_PLANS; i++) {
+    free_plan(resample_plans[i].plan);
+    resample_plans[i].plan = NULL;
+  }
+}
+
+typedef struct {
+  Image source;
+  Image target;
+  const ResamplePlan *plan;
+} ResamplePass;
+
+/**
+ * Resamples a band of the rows of the source into the target, which is as
+ * high as the source.
+ */
+static void resample_rows(void *arg, size_t band) {
+  const ResamplePass *pass = arg;
+  const ResamplePlan *plan = pass->plan;
+  const int32_t first_y = (int32_t)band * RESAMPLE_BAND_HEIGHT;
+  const int32_t end_y =
+      min(first_y + RESAMPLE_BAND_HEIGHT, pass->target.frame->height);
+  const PixelRowWriter write_pixels = get_pixel_row_writer(pass->target);
+  Pixel *row = malloc((plan->last - plan->first + 1) * sizeof(Pixel));
+  Pixel *pixels = malloc(plan->target_length * sizeof(Pixel));
+  if (row == NULL || pixels == NULL) {
+    errOutput("unable to allocate resample buffers.");
+  }
+
+  for (int32_t y = first_y; y < end_y; y++) {
+    get_pixel_span(pass->source, (Point){plan->first, y},
+                   plan->last - plan->first + 1, row);
+
+    for (int32_t x = 0; x < plan->target_length; x++) {
+      const ResampleTaps *taps = &plan->taps[x];
+      const Pixel *in = &row[taps->first - plan->first];
+      const int32_t *weights = &plan->weights[taps->weights];
+      int32_t r = 0, g = 0, b = 0;
+
+      for (int32_t i = 0; i < taps->count; i++) {
+        r += weights[i] * in[i].r;
+        g += weights[i] * in[i].g;
+        b += weights[i] * in[i].b;
+      }
+      pixels[x] = (Pixel){av_clip_uint8(r >> INTERP_WEIGHT_SHIFT),
+                          av_clip_uint8(g >> INTERP_WEIGHT_SHIFT),
+                          av_clip_uint8(b >> INTERP_WEIGHT_SHIFT)};
+    }
+    write_pixels(get_writable_pixel_row(pass->target, y), 0,
+                 plan->target_length, pixels, pass->target.abs_black_threshold);
+  }
+
+  free(pixels);
+  free(row);
+}
+
+/**
+ * Resamples the columns of the source into a band of the rows of the target,
+ * which is as wide as the source. Each target row adds up whole source rows.
+ */
+static void resample_columns(void *arg, size_t band) {
+  const ResamplePass *pass = arg;
+  const ResamplePlan *plan = pass->plan;
+  const int32_t width = pass->target.frame->width;
+  const int32_t first_y = (int32_t)band * RESAMPLE_BAND_HEIGHT;
+  const int32_t end_y =
+      min(first_y + RESAMPLE_BAND_HEIGHT, plan->target_length);
+  const PixelRowWriter write_pixels = get_pixel_row_writer(pass->target);
+  Pixel *row = malloc(width * sizeof(Pixel));
+  int32_t *sums = malloc(width * 3 * sizeof(int32_t));
+  if (row == NULL || sums == NULL) {
+    errOutput("unable to allocate resample buffers.");
+  }
+
+  for (int32_t y = first_y; y < end_y; y++) {
+    const ResampleTaps *taps = &plan->taps[y];
+
+    for (int32_t x = 0; x < width * 3; x++) {
+      sums[x] = 0;
+    }
+    for (int32_t i = 0; i < taps->count; i++) {
+      const int32_t weight = plan->weights[taps->weights + i];
+
+      get_pixel_span(pass->source, (Point){0, taps->first + i}, width, row);
+      for (int32_t x = 0; x < width; x++) {
+        sums[3 * x] += weight * row[x].r;
+        sums[3 * x + 1] += weight * row[x].g;
+        sums[3 * x + 2] += weight * row[x].b;
+      }
+    }
+
+    for (int32_t x = 0; x < width; x++) {
+      row[x] = (Pixel){av_clip_uint8(sums[3 * x] >> INTERP_WEIGHT_SHIFT),
+                       av_clip_uint8(sums[3 * x + 1] >> INTERP_WEIGHT_SHIFT),
+                       av_clip_uint8(sums[3 * x + 2] >> INTERP_WEIGHT_SHIFT)};
+    }
+    write_pixels(get_writable_pixel_row(pass->target, y), 0, width, row,
+                 pass->target.abs_black_threshold);
+  }
+
+  free(sums);
+  free(row);
+}
+
+/**
+ * Resamples the whole source image to the size of the target image, one
+ * dimension after the other, with bands of rows resampled in parallel.
+ */
+void resample_image(Image source, Image target,
+                    Interpolation interpolate_type) {
+  const RectangleSize source_size = size_of_image(source);
+  const RectangleSize target_size = size_of_image(target);
+  ResamplePass rows = {
+      .source = source,
+      .target = create_compatible_image(
+          source, (RectangleSize){target_size.width, source_size.height},
+          false),
+      .plan = get_plan(source_size.width, target_size.width, interpolate_type),
+  };
+  ResamplePass columns = {
+      .source = rows.target,
+      .target = target,
+      .plan =
+          get_plan(source_size.height, target_size.height, interpolate_type),
+  };
+
+  parallel_for(
+      (source_size.height + RESAMPLE_BAND_HEIGHT - 1) / RESAMPLE_BAND_HEIGHT,
+      resample_rows, &rows);
+  parallel_for(
+      (target_size.height + RESAMPLE_BAND_HEIGHT - 1) / RESAMPLE_BAND_HEIGHT,
+      resample_columns, &columns);
+
+  free_image(&rows.target);
+}
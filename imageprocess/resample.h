@@ -0,0 +1,11 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "imageprocess/image.h"
+#include "imageprocess/interpolate.h"
+
+void resample_image(Image source, Image target, Interpolation interpolate_type);
+void free_resample_plans(void);
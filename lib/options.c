@@ -395,3 +395,34 @@ bool parse_interpolate(const char *str, Interpolation *interpolation) {
 
   return false;
 }
+
+static const struct {
+  const char name[12];
+  DeskewMethod method;
+} DESKEW_METHODS[] = {
+    {"edge", DESKEW_METHOD_EDGE},
+    {"projection", DESKEW_METHOD_PROJECTION},
+};
+
+bool parse_deskew_method(const char *str, DeskewMethod *method) {
+  for (size_t j = 0; j < sizeof(DESKEW_METHODS) / sizeof(DESKEW_METHODS[0]);
+       j++) {
+    if (strcasecmp(str, DESKEW_METHODS[j].name) == 0) {
+      *method = DESKEW_METHODS[j].method;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+const char *deskew_method_to_string(DeskewMethod method) {
+  for (size_t j = 0; j < sizeof(DESKEW_METHODS) / sizeof(DESKEW_METHODS[0]);
+       j++) {
+    if (DESKEW_METHODS[j].method == method) {
+      return DESKEW_METHODS[j].name;
+    }
+  }
+
+  return "unknown";
+}
@@ -125,3 +125,6 @@ int print_edges(Edges edges);
 bool parse_layout(const char *str, Layout *layout);
 
 bool parse_interpolate(const char *str, Interpolation *interpolation);
+
+bool parse_deskew_method(const char *str, DeskewMethod *method);
+const char *deskew_method_to_string(DeskewMethod method);
@@ -0,0 +1,178 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libavutil/cpu.h>
+
+#include "lib/math_util.h"
+#include "lib/parallel.h"
+
+// Upper bound to the number of threads running parallel_for() jobs.
+#define MAX_THREADS 64
+
+// Stack size of the worker threads. The default for new threads depends on the
+// C library and can be as small as 128KiB, so ask for what a main thread
+// usually gets instead.
+#define WORKER_STACK_SIZE (8 * 1024 * 1024)
+
+/**
+ * Worker threads are started the first time parallel_for() is called, and then
+ * wait for the next call, rather than being started and joined for each call:
+ * a sheet goes through several parallel passes, some of them short.
+ *
+ * Each call is a new generation of the pool. The workers taking part in it run
+ * their share of the indexes, and the last one to finish wakes up the caller.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+  pthread_t threads[MAX_THREADS];
+  size_t threads_count; // workers started, the caller being the extra one
+  bool busy;
+  bool stopping;
+  uint64_t generation;
+  ParallelJob job;
+  void *arg;
+  size_t count;
+  size_t stride;
+  size_t pending; // workers that have not finished their share yet
+} WorkerPool;
+
+static WorkerPool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_ready = PTHREAD_COND_INITIALIZER,
+    .work_done = PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void run_share(ParallelJob job, void *arg, size_t first, size_t count,
+                      size_t stride) {
+  for (size_t index = first; index < count; index += stride) {
+    job(arg, index);
+  }
+}
+
+static void *worker_thread(void *arg) {
+  // Worker n runs the share starting at index n + 1.
+  const size_t share = (size_t)(uintptr_t)arg + 1;
+  uint64_t generation = 0;
+
+  pthread_mutex_lock(&pool.lock);
+  while (true) {
+    while (!pool.stopping && pool.generation == generation) {
+      pthread_cond_wait(&pool.work_ready, &pool.lock);
+    }
+    if (pool.stopping) {
+      break;
+    }
+    generation = pool.generation;
+    if (share >= pool.stride) {
+      continue;
+    }
+
+    const ParallelJob job = pool.job;
+    void *const arg = pool.arg;
+    const size_t count = pool.count;
+    const size_t stride = pool.stride;
+    pthread_mutex_unlock(&pool.lock);
+
+    run_share(job, arg, share, count, stride);
+
+    pthread_mutex_lock(&pool.lock);
+    if (--pool.pending == 0) {
+      pthread_cond_signal(&pool.work_done);
+    }
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+  return NULL;
+}
+
+static void start_workers(void) {
+  const size_t wanted = min((size_t)av_cpu_count(), (size_t)MAX_THREADS) - 1;
+  pthread_attr_t attr;
+  const bool attr_set = pthread_attr_init(&attr) == 0;
+
+  if (attr_set) {
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+  }
+
+  // If fewer workers can be started, the indexes are split into fewer shares.
+  pthread_mutex_lock(&pool.lock);
+  while (!pool.stopping && pool.threads_count < wanted &&
+         pthread_create(&pool.threads[pool.threads_count],
+                        attr_set ? &attr : NULL, worker_thread,
+                        (void *)(uintptr_t)pool.threads_count) == 0) {
+    pool.threads_count++;
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+  if (attr_set) {
+    pthread_attr_destroy(&attr);
+  }
+}
+
+/**
+ * Calls job(arg, index) for every index from 0 to count - 1, spreading the
+ * calls over as many threads as there are CPU cores. Each thread handles a
+ * fixed set of indexes, and the function only returns once all the calls are
+ * done.
+ *
+ * The jobs must not depend on each other's order, and must not touch any
+ * shared state besides what they are given through arg, like the integral
+ * images of an image or the buffer pools. A job calling parallel_for() again
+ * runs the nested indexes itself.
+ */
+void parallel_for(size_t count, ParallelJob job, void *arg) {
+  pthread_once(&pool_once, start_workers);
+
+  pthread_mutex_lock(&pool.lock);
+  if (pool.busy || pool.threads_count == 0 || count <= 1) {
+    pthread_mutex_unlock(&pool.lock);
+    run_share(job, arg, 0, count, 1);
+    return;
+  }
+
+  const size_t stride = min(count, pool.threads_count + 1);
+  pool.busy = true;
+  pool.job = job;
+  pool.arg = arg;
+  pool.count = count;
+  pool.stride = stride;
+  pool.pending = stride - 1;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.work_ready);
+  pthread_mutex_unlock(&pool.lock);
+
+  run_share(job, arg, 0, count, stride);
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.pending > 0) {
+    pthread_cond_wait(&pool.work_done, &pool.lock);
+  }
+  pool.busy = false;
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * Stops and joins the worker threads. Later calls to parallel_for() run their
+ * jobs on the calling thread.
+ */
+void stop_parallel_workers(void) {
+  pthread_mutex_lock(&pool.lock);
+  pool.stopping = true;
+  const size_t threads_count = pool.threads_count;
+  pool.threads_count = 0;
+  pthread_cond_broadcast(&pool.work_ready);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (size_t i = 0; i < threads_count; i++) {
+    pthread_join(pool.threads[i], NULL);
+  }
+}
@@ -0,0 +1,12 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stddef.h>
+
+typedef void (*ParallelJob)(void *arg, size_t index);
+
+void parallel_for(size_t count, ParallelJob job, void *arg);
+void stop_parallel_workers(void);
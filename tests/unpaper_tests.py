@@ -261,6 +261,76 @@ def test_sheet_stretch(imgsrc_path, goldendir_path, tmp_path):
     assert compare_images(golden=golden_path, result=result_path) < 0.05
 
 
+def test_zoom_cubic(imgsrc_path, goldendir_path, tmp_path):
+    """[D4] Crop to sheet size, then zoom with cubic interpolation."""
+    source_path = imgsrc_path / "imgsrc004.png"
+    result_path = tmp_path / "result.pgm"
+    golden_path = goldendir_path / "goldenD4.pgm"
+
+    run_unpaper(
+        "-n",
+        "--sheet-size",
+        "6cm,6cm",
+        "--zoom",
+        "1.5",
+        "--interpolate",
+        "cubic",
+        str(source_path),
+        str(result_path),
+    )
+
+    # Interpolating with float weights instead of the quantized tables differs
+    # on 1.65% of the pixels.
+    assert compare_images(golden=golden_path, result=result_path) < 0.001
+
+
+@pytest.mark.parametrize("interpolation", ["linear", "cubic"])
+def test_sheet_stretch_reduce(
+    imgsrc_path, goldendir_path, tmp_path, interpolation
+):
+    """[D5] Stretch to a smaller sheet size, averaging the covered pixels."""
+    source_path = imgsrc_path / "imgsrc004.png"
+    result_path = tmp_path / "result.pgm"
+    golden_path = goldendir_path / "goldenD5.pgm"
+
+    run_unpaper(
+        "-n",
+        "--stretch",
+        "5cm,7cm",
+        "--interpolate",
+        interpolation,
+        str(source_path),
+        str(result_path),
+    )
+
+    # Both interpolations average the same areas when shrinking. Sampling a
+    # single point per pixel instead changes about a quarter of the pixels.
+    assert compare_images(golden=golden_path, result=result_path) < 0.001
+
+
+def test_zoom_linear(imgsrc_path, goldendir_path, tmp_path):
+    """[D6] Crop to sheet size, then zoom with linear interpolation."""
+    source_path = imgsrc_path / "imgsrc004.png"
+    result_path = tmp_path / "result.pgm"
+    golden_path = goldendir_path / "goldenD6.pgm"
+
+    run_unpaper(
+        "-n",
+        "--sheet-size",
+        "4cm,4cm",
+        "--zoom",
+        "2",
+        "--interpolate",
+        "linear",
+        str(source_path),
+        str(result_path),
+    )
+
+    # Every other row and column falls on a source pixel, and is interpolated
+    # along the other direction.
+    assert compare_images(golden=golden_path, result=result_path) < 0.001
+
+
 def test_e1(imgsrc_path, goldendir_path, tmp_path):
     """[E1] Splitting 2-page layout into separate output pages (with input and output wildcard)."""
 
@@ -415,6 +485,129 @@ def test_f3(imgsrc_path, goldendir_path, tmp_path):
     assert compare_images(golden=golden_path, result=result_path) < 0.05
 
 
+def test_noisefilter(imgsrc_path, goldendir_path, tmp_path):
+    """[G1] Noise filter only, deleting clusters of up to 9 pixels."""
+
+    source_path = imgsrc_path / "imgsrc002.png"
+    result_path = tmp_path / "result.pbm"
+    golden_path = goldendir_path / "goldenG1.pbm"
+
+    run_unpaper(
+        "--no-blackfilter",
+        "--no-blurfilter",
+        "--no-grayfilter",
+        "--no-mask-scan",
+        "--no-deskew",
+        "--no-border-scan",
+        "--noisefilter-intensity",
+        "9",
+        str(source_path),
+        str(result_path),
+    )
+
+    # The filter only touches a few hundred isolated pixels, so any difference
+    # is significant.
+    assert compare_images(golden=golden_path, result=result_path) == 0
+
+
+@pytest.mark.parametrize("coarse_step", ["1", "0.25"])
+def test_deskew_coarse_scan(imgsrc_path, tmp_path, coarse_step):
+    """[H1] Coarse-to-fine deskew scan, finding the same angle as a full scan."""
+
+    source_path = imgsrc_path / "imgsrc001.png"
+    full_scan_path = tmp_path / "full.pbm"
+    result_path = tmp_path / "result.pbm"
+
+    run_unpaper(str(source_path), str(full_scan_path))
+    # 0.25 is not a multiple of the 0.1 degrees scan step.
+    run_unpaper(
+        "--deskew-scan-coarse-step",
+        coarse_step,
+        str(source_path),
+        str(result_path),
+    )
+
+    assert compare_images(golden=full_scan_path, result=result_path) == 0
+
+
+def test_deskew_scan_substep(imgsrc_path, goldendir_path, tmp_path):
+    """[H2] Coarse-to-fine deskew scan, refined below the scan step."""
+
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_path = tmp_path / "result.pbm"
+    golden_path = goldendir_path / "goldenH2.pbm"
+
+    run_unpaper(
+        "--deskew-scan-coarse-step",
+        "0.25",
+        "--deskew-scan-substep",
+        str(source_path),
+        str(result_path),
+    )
+
+    # The refined angle is only a fraction of a scan step away from the one a
+    # plain scan finds, which changes about 0.1% of the pixels.
+    assert compare_images(golden=golden_path, result=result_path) < 0.0005
+
+
+def test_deskew_projection(imgsrc_path, goldendir_path, tmp_path):
+    """[H3] Black+White, Full Processing, projection deskew."""
+
+    source_path = imgsrc_path / "imgsrc001.png"
+    edge_scan_path = tmp_path / "edges.pbm"
+    result_path = tmp_path / "result.pbm"
+    golden_path = goldendir_path / "goldenA1.pbm"
+
+    run_unpaper(str(source_path), str(edge_scan_path))
+    run_unpaper(
+        "--deskew-method", "projection", str(source_path), str(result_path)
+    )
+
+    assert compare_images(golden=golden_path, result=result_path) < 0.05
+    # Both methods find the same skew on this page.
+    assert compare_images(golden=edge_scan_path, result=result_path) == 0
+
+
+def test_deskew_shear(imgsrc_path, tmp_path):
+    """[H4] Deskewing by three shears, compared to an interpolating rotation."""
+
+    source_path = imgsrc_path / "imgsrc001.png"
+    rotated_path = tmp_path / "rotated.pbm"
+    result_path = tmp_path / "result.pbm"
+
+    # The page is skewed by 4 degrees. Mask centering and border alignment are
+    # disabled, as a few differing edge pixels can shift the whole page by one.
+    options = ["--no-mask-center", "--no-border-align"]
+    run_unpaper(*options, str(source_path), str(rotated_path))
+    run_unpaper(
+        *options,
+        "--deskew-shear-limit",
+        "5",
+        str(source_path),
+        str(result_path),
+    )
+
+    assert compare_images(golden=rotated_path, result=result_path) < 0.005
+
+
+def test_deskew_invalid_scan_step(imgsrc_path, tmp_path):
+    """[H5] Zero deskew scan step with a coarse scan, which is rejected."""
+
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_path = tmp_path / "result.pbm"
+
+    unpaper_result = run_unpaper(
+        "--deskew-scan-step",
+        "0",
+        "--deskew-scan-coarse-step",
+        "1",
+        str(source_path),
+        str(result_path),
+        check=False,
+    )
+    assert unpaper_result.returncode != 0
+
+
 def test_overwrite_no_file(imgsrc_path, tmp_path):
     source_path = imgsrc_path / "imgsrc001.png"
     result_path = tmp_path / "result.pbm"
@@ -25,7 +25,9 @@
 #include "imageprocess/interpolate.h"
 #include "imageprocess/masks.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/resample.h"
 #include "lib/options.h"
+#include "lib/parallel.h"
 #include "lib/physical.h"
 #include "parse.h"
 #include "unpaper.h"
@@ -109,12 +111,16 @@ enum LONG_OPTION_VALUES {
   OPT_MASK_COLOR,
   OPT_NO_MASK_CENTER,
   OPT_NO_DESKEW,
+  OPT_DESKEW_METHOD,
   OPT_DESKEW_SCAN_DIRECTION,
   OPT_DESKEW_SCAN_SIZE,
   OPT_DESKEW_SCAN_DEPTH,
   OPT_DESKEW_SCAN_RANGE,
   OPT_DESKEW_SCAN_STEP,
+  OPT_DESKEW_SCAN_COARSE_STEP,
+  OPT_DESKEW_SCAN_SUBSTEP,
   OPT_DESKEW_SCAN_DEVIATION,
+  OPT_DESKEW_SHEAR_LIMIT,
   OPT_NO_BORDER_SCAN,
   OPT_BORDER_SCAN_DIRECTION,
   OPT_BORDER_SCAN_SIZE,
@@ -140,6 +146,55 @@ enum LONG_OPTION_VALUES {
   OPT_INTERPOLATE,
 };
 
+static bool pixel_is_gray(Pixel pixel) {
+  return pixel.r == pixel.g && pixel.g == pixel.b;
+}
+
+static bool pixel_is_bilevel(Pixel pixel) {
+  return pixel_is_gray(pixel) && (pixel.r == 0 || pixel.r == UINT8_MAX);
+}
+
+static bool pixel_format_is_bilevel(int format) {
+  return format == AV_PIX_FMT_MONOWHITE || format == AV_PIX_FMT_MONOBLACK;
+}
+
+/**
+ * Chooses the pixel format the sheet is processed in, as the most compact one
+ * that can hold the loaded pages without loss.
+ *
+ * Bilevel pages are kept packed (MONOWHITE) when the output is bilevel too,
+ * and only black and white can be painted on the sheet; they are converted to
+ * grayscale later if an interpolation needs it. Otherwise grayscale and
+ * bilevel pages are processed as GRAY8, and RGB24 is only needed when one of
+ * the pages, or one of the colors the sheet may be filled with, is not a
+ * shade of gray.
+ */
+static int sheet_pixel_format(const Image pages[], int count,
+                              const Options *options) {
+  if (!pixel_is_gray(options->sheet_background) ||
+      !pixel_is_gray(options->mask_color)) {
+    return AV_PIX_FMT_RGB24;
+  }
+
+  bool bilevel = pixel_format_is_bilevel(options->output_pixel_format) &&
+                 pixel_is_bilevel(options->sheet_background) &&
+                 pixel_is_bilevel(options->mask_color);
+  bool loaded = false;
+
+  for (int i = 0; i < count; i++) {
+    if (pages[i].frame == NULL) {
+      continue;
+    }
+    if (pages[i].frame->format == AV_PIX_FMT_RGB24) {
+      return AV_PIX_FMT_RGB24;
+    }
+    loaded = true;
+    bilevel = bilevel && pixel_format_is_bilevel(pages[i].frame->format);
+  }
+
+  return (loaded && bilevel) ? AV_PIX_FMT_MONOWHITE : AV_PIX_FMT_GRAY8;
+}
+
 /****************************************************************************
  * MAIN()                                                                   *
  ****************************************************************************/
@@ -173,13 +228,17 @@ int main(int argc, char *argv[]) {
     float whiteThreshold = 0.9;
     float blackThreshold = 0.33;
 
+    DeskewMethod deskewMethod = DESKEW_METHOD_EDGE;
     Edges deskewScanEdges = {
         .left = true, .top = false, .right = true, .bottom = false};
     int deskewScanSize = 1500;
     float deskewScanDepth = 0.5;
     float deskewScanRange = 5.0;
     float deskewScanStep = 0.1;
+    float deskewScanCoarseStep = 0.0;
+    bool deskewScanSubstep = false;
     float deskewScanDeviation = 1.0;
+    float deskewShearLimit = 0.0;
     Direction maskScanDirections = DIRECTION_HORIZONTAL;
     RectangleSize maskScanSize = {50, 50};
     int32_t maskScanDepth[DIRECTIONS_COUNT] = {-1, -1};
@@ -329,6 +388,7 @@ int main(int argc, char *argv[]) {
           {"mc", required_argument, NULL, OPT_MASK_COLOR},
           {"no-mask-center", optional_argument, NULL, OPT_NO_MASK_CENTER},
           {"no-deskew", optional_argument, NULL, OPT_NO_DESKEW},
+          {"deskew-method", required_argument, NULL, OPT_DESKEW_METHOD},
           {"deskew-scan-direction", required_argument, NULL,
            OPT_DESKEW_SCAN_DIRECTION},
           {"dn", required_argument, NULL, OPT_DESKEW_SCAN_DIRECTION},
@@ -340,9 +400,14 @@ int main(int argc, char *argv[]) {
           {"dr", required_argument, NULL, OPT_DESKEW_SCAN_RANGE},
           {"deskew-scan-step", required_argument, NULL, OPT_DESKEW_SCAN_STEP},
           {"dp", required_argument, NULL, OPT_DESKEW_SCAN_STEP},
+          {"deskew-scan-coarse-step", required_argument, NULL,
+           OPT_DESKEW_SCAN_COARSE_STEP},
+          {"deskew-scan-substep", no_argument, NULL, OPT_DESKEW_SCAN_SUBSTEP},
           {"deskew-scan-deviation", required_argument, NULL,
            OPT_DESKEW_SCAN_DEVIATION},
           {"dv", required_argument, NULL, OPT_DESKEW_SCAN_DEVIATION},
+          {"deskew-shear-limit", required_argument, NULL,
+           OPT_DESKEW_SHEAR_LIMIT},
           {"no-border-scan", optional_argument, NULL, OPT_NO_BORDER_SCAN},
           {"border-scan-direction", required_argument, NULL,
            OPT_BORDER_SCAN_DIRECTION},
@@ -754,6 +819,12 @@ int main(int argc, char *argv[]) {
         parseMultiIndex(optarg, &options.no_deskew_multi_index);
         break;
 
+      case OPT_DESKEW_METHOD:
+        if (!parse_deskew_method(optarg, &deskewMethod)) {
+          errOutput("unable to parse deskew-method: '%s'", optarg);
+        }
+        break;
+
       case OPT_DESKEW_SCAN_DIRECTION:
         if (!parse_edges(optarg, &deskewScanEdges)) {
           errOutput("uanble to parse deskew-scan-direction: '%s'", optarg);
@@ -776,10 +847,22 @@ int main(int argc, char *argv[]) {
         sscanf(optarg, "%f", &deskewScanStep);
         break;
 
+      case OPT_DESKEW_SCAN_COARSE_STEP:
+        sscanf(optarg, "%f", &deskewScanCoarseStep);
+        break;
+
+      case OPT_DESKEW_SCAN_SUBSTEP:
+        deskewScanSubstep = true;
+        break;
+
       case OPT_DESKEW_SCAN_DEVIATION:
         sscanf(optarg, "%f", &deskewScanDeviation);
         break;
 
+      case OPT_DESKEW_SHEAR_LIMIT:
+        sscanf(optarg, "%f", &deskewShearLimit);
+        break;
+
       case OPT_NO_BORDER_SCAN:
         parseMultiIndex(optarg, &options.no_border_scan_multi_index);
         break;
@@ -949,10 +1032,11 @@ int main(int argc, char *argv[]) {
     options.abs_black_threshold = WHITE * (1.0 - blackThreshold);
     options.abs_white_threshold = WHITE * (whiteThreshold);
 
-    if (!validate_deskew_parameters(&options.deskew_parameters, deskewScanRange,
-                                    deskewScanStep, deskewScanDeviation,
-                                    deskewScanSize, deskewScanDepth,
-                                    deskewScanEdges)) {
+    if (!validate_deskew_parameters(
+            &options.deskew_parameters, deskewMethod, deskewScanRange,
+            deskewScanStep, deskewScanCoarseStep, deskewScanSubstep,
+            deskewScanDeviation, deskewScanSize, deskewScanDepth,
+            deskewScanEdges, deskewShearLimit)) {
       errOutput("deskew parameters are not valid.");
     }
     if (!validate_mask_detection_parameters(
@@ -1130,18 +1214,20 @@ int main(int argc, char *argv[]) {
       }
 
       // load input image(s)
+      Image pages[2] = {EMPTY_IMAGE, EMPTY_IMAGE};
       for (int j = 0; j < options.input_count; j++) {
         if (inputFileNames[j] !=
             NULL) { // may be null if --insert-blank or --replace-blank
           verboseLog(VERBOSE_MORE, "loading file %s.\n", inputFileNames[j]);
 
-          loadImage(inputFileNames[j], &page, options.sheet_background,
+          loadImage(inputFileNames[j], &pages[j], options.sheet_background,
                     options.abs_black_threshold);
-          saveDebug("_loaded_%d.pnm", inputNr - options.input_count + j, page);
+          saveDebug("_loaded_%d.pnm", inputNr - options.input_count + j,
+                    pages[j]);
 
           if (options.output_pixel_format == AV_PIX_FMT_NONE &&
-              page.frame != NULL) {
-            options.output_pixel_format = page.frame->format;
+              pages[j].frame != NULL) {
+            options.output_pixel_format = pages[j].frame->format;
           }
 
           // pre-rotate
@@ -1149,41 +1235,48 @@ int main(int argc, char *argv[]) {
             verboseLog(VERBOSE_NORMAL, "pre-rotating %hd degrees.\n",
                        options.pre_rotate);
 
-            flip_rotate_90(&page, options.pre_rotate / 90);
+            flip_rotate_90(&pages[j], options.pre_rotate / 90);
           }
 
           // if sheet-size is not known yet (and not forced by --sheet-size),
           // set now based on size of (first) input image
           RectangleSize inputSheetSize = {
-              .width = page.frame->width * options.input_count,
-              .height = page.frame->height,
+              .width = pages[j].frame->width * options.input_count,
+              .height = pages[j].frame->height,
           };
           inputSize = coerce_size(
               inputSize, coerce_size(options.sheet_size, inputSheetSize));
-        } else { // inputFiles[j] == NULL
-          page = EMPTY_IMAGE;
         }
+      }
 
-        // place image into sheet buffer
-        // allocate sheet-buffer if not done yet
-        if ((sheet.frame == NULL) && (inputSize.width != -1) &&
-            (inputSize.height != -1)) {
-          sheet = create_image(inputSize, AV_PIX_FMT_RGB24, true,
-                               options.sheet_background,
-                               options.abs_black_threshold);
-        }
-        if (page.frame != NULL) {
-          saveDebug("_page%d.pnm", inputNr - options.input_count + j, page);
+      // allocate sheet-buffer if not done yet, in a pixel format that can
+      // hold all the loaded pages
+      if ((sheet.frame == NULL) && (inputSize.width != -1) &&
+          (inputSize.height != -1)) {
+        sheet = create_image(inputSize,
+                             sheet_pixel_format(pages, options.input_count,
+                                                &options),
+                             true, options.sheet_background,
+                             options.abs_black_threshold);
+      }
+
+      // place image(s) into sheet buffer
+      for (int j = 0; j < options.input_count; j++) {
+        if (pages[j].frame != NULL) {
+          saveDebug("_page%d.pnm", inputNr - options.input_count + j,
+                    pages[j]);
           saveDebug("_before_center_page%d.pnm",
                     inputNr - options.input_count + j, sheet);
 
-          center_image(page, sheet,
+          center_image(pages[j], sheet,
                        (Point){(inputSize.width * j / options.input_count), 0},
                        (RectangleSize){(inputSize.width / options.input_count),
                                        inputSize.height});
 
           saveDebug("_after_center_page%d.pnm",
                     inputNr - options.input_count + j, sheet);
+
+          free_image(&pages[j]);
         }
       }
 
@@ -1200,8 +1293,9 @@ int main(int argc, char *argv[]) {
           errOutput("sheet size unknown, use at least one input file per "
                     "sheet, or force using --sheet-size.");
         } else {
-          sheet = create_image(inputSize, AV_PIX_FMT_RGB24, true,
-                               options.sheet_background,
+          sheet = create_image(inputSize,
+                               sheet_pixel_format(NULL, 0, &options),
+                               true, options.sheet_background,
                                options.abs_black_threshold);
         }
       }
@@ -1222,7 +1316,7 @@ int main(int argc, char *argv[]) {
         verboseLog(VERBOSE_NORMAL, "pre-shifting [%" PRId32 ",%" PRId32 "]\n",
                    options.pre_shift.horizontal, options.pre_shift.vertical);
 
-        shift_image(&sheet, options.pre_shift);
+        shift_image(sheet, options.pre_shift);
       }
 
       // pre-masking
@@ -1403,6 +1497,8 @@ int main(int argc, char *argv[]) {
           printf("mask-scan DISABLED for all sheets.\n");
         }
         if (options.no_deskew_multi_index.count != -1) {
+          printf("deskew-method: %s\n",
+                 deskew_method_to_string(options.deskew_parameters.method));
           printf("deskew-scan-direction: ");
           print_edges(options.deskew_parameters.scan_edges);
           printf("deskew-scan-size: %d\n",
@@ -1413,8 +1509,19 @@ int main(int argc, char *argv[]) {
                  options.deskew_parameters.deskewScanRangeRad);
           printf("deskew-scan-step: %f\n",
                  options.deskew_parameters.deskewScanStepRad);
+          if (options.deskew_parameters.deskewScanCoarseStepRad > 0) {
+            printf("deskew-scan-coarse-step: %f\n",
+                   options.deskew_parameters.deskewScanCoarseStepRad);
+          }
+          if (options.deskew_parameters.deskewScanSubstep) {
+            printf("deskew-scan-substep: enabled\n");
+          }
           printf("deskew-scan-deviation: %f\n",
                  options.deskew_parameters.deskewScanDeviationRad);
+          if (options.deskew_parameters.deskewShearLimitRad > 0) {
+            printf("deskew-shear-limit: %f\n",
+                   options.deskew_parameters.deskewShearLimitRad);
+          }
           if (options.no_deskew_multi_index.count > 0) {
             printf("deskew-scan DISABLED for sheets: ");
             printMultiIndex(options.no_deskew_multi_index);
@@ -1732,17 +1839,35 @@ int main(int argc, char *argv[]) {
           verboseLog(VERBOSE_MORE, "(mask-scan before deskewing disabled)\n");
         }
 
-        // auto-deskew each mask
+        // auto-deskew each mask; deskewing a mask only changes the pixels
+        // within it, so the rotation of disjoint masks can be detected all at
+        // once, before deskewing any of them
+        float rotations[MAX_MASKS];
+        bool disjoint_masks = true;
+        for (size_t i = 1; i < maskCount; i++) {
+          disjoint_masks =
+              disjoint_masks && !rectangle_overlap_any(masks[i], i, masks);
+        }
+        if (disjoint_masks) {
+          detect_rotations(sheet, masks, maskCount, options.deskew_parameters,
+                           rotations);
+        }
+
         for (size_t i = 0; i < maskCount; i++) {
-          float rotation =
-              detect_rotation(sheet, masks[i], options.deskew_parameters);
+          if (!disjoint_masks) {
+            detect_rotations(sheet, &masks[i], 1, options.deskew_parameters,
+                             &rotations[i]);
+          }
+          float rotation = rotations[i];
 
           verboseLog(VERBOSE_NORMAL, "rotate (%d,%d): %f\n", points[i].x,
                      points[i].y, rotation);
 
           if (rotation != 0.0) {
             saveDebug("_before-deskew-detect%d.pnm", nr * maskCount + i, sheet);
-            deskew(sheet, masks[i], rotation, options.interpolate_type);
+            prepare_for_interpolation(&sheet, options.interpolate_type);
+            deskew(sheet, masks[i], rotation, options.interpolate_type,
+                   options.deskew_parameters);
             saveDebug("_after-deskew-detect%d.pnm", nr * maskCount + i, sheet);
           }
         }
@@ -1847,7 +1972,7 @@ int main(int argc, char *argv[]) {
         verboseLog(VERBOSE_NORMAL, "post-shifting [%" PRId32 ",%" PRId32 "]\n",
                    options.post_shift.horizontal, options.post_shift.vertical);
 
-        shift_image(&sheet, options.post_shift);
+        shift_image(sheet, options.post_shift);
       }
 
       // post-rotating
@@ -1920,5 +2045,9 @@ int main(int argc, char *argv[]) {
       optind -= 2;
   }
 
+  stop_parallel_workers();
+  free_resample_plans();
+  free_buffer_pools();
+
   return 0;
 }